@@ -0,0 +1,109 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include "../webserver/log.h"
+#include "../webserver/mutex.h"
+
+// 临界区只把一行日志拷进缓冲区，模拟带缓冲的appender
+class MemoryLogAppender : public webserver::LogAppender {
+public:
+    void log(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event) override {
+    }
+    void write(const char* data, size_t len) override {
+        webserver::PolicyMutex::Lock lock(m_mutex);
+        if (m_pos + len > sizeof(m_buf)) {
+            m_pos = 0;
+        }
+        memcpy(m_buf + m_pos, data, len);
+        m_pos += len;
+    }
+private:
+    char m_buf[64 * 1024];
+    size_t m_pos = 0;
+};
+
+/*
+ * threads个线程一共执行n次f，输出平均每次的耗时(总墙钟时间/n)
+ * */
+template<class F>
+static double Run(int threads, size_t n, F f) {
+    std::vector<std::thread> ts;
+    size_t per = n / threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        ts.emplace_back([&f, per]() {
+            for (size_t i = 0; i < per; ++i) {
+                f();
+            }
+        });
+    }
+    for (auto& t : ts) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (per * threads);
+}
+
+int main(int argc, char** argv) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int thread_counts[] = {1, 2, 4, 8, 16, 32, 64};
+    std::string line = "2024-01-01 00:00:00.000\t1\tmain\t[INFO]\t[bench]\tbench_lock.cc:60\trequest took 1.5 ms\n";
+
+    std::cout << std::left << std::setw(24) << "appender write (ns/op)";
+    for (int threads : thread_counts) {
+        std::cout << std::right << std::setw(9) << threads;
+    }
+    std::cout << std::endl;
+
+    webserver::PolicyMutex::Policy policies[] = {webserver::PolicyMutex::NONE,
+                                                 webserver::PolicyMutex::SPIN,
+                                                 webserver::PolicyMutex::MUTEX};
+    for (auto policy : policies) {
+        std::cout << std::left << std::setw(24) << webserver::PolicyMutex::ToString(policy);
+        for (int threads : thread_counts) {
+            if (policy == webserver::PolicyMutex::NONE && threads > 1) {
+                std::cout << std::right << std::setw(9) << "-";   // 不加锁只能单线程用
+                continue;
+            }
+            MemoryLogAppender appender;
+            appender.setLockPolicy(policy);
+            double ns = Run(threads, n, [&]() {
+                appender.write(line.data(), line.size());
+            });
+            std::cout << std::right << std::setw(9) << std::fixed << std::setprecision(1) << ns;
+        }
+        std::cout << std::endl;
+    }
+
+    // 读配置：每次取logger的默认formatter，对比读写锁和互斥量
+    std::cout << std::left << std::setw(24) << "config read (ns/op)" << std::endl;
+    webserver::LogFormatter::ptr formatter(new webserver::LogFormatter("%d %m%n"));
+    {
+        webserver::RWMutex rwmutex;
+        std::cout << std::left << std::setw(24) << "rwlock";
+        for (int threads : thread_counts) {
+            double ns = Run(threads, n, [&]() {
+                webserver::RWMutex::ReadLock lock(rwmutex);
+                webserver::LogFormatter::ptr f = formatter;
+            });
+            std::cout << std::right << std::setw(9) << std::fixed << std::setprecision(1) << ns;
+        }
+        std::cout << std::endl;
+    }
+    {
+        webserver::Mutex mutex;
+        std::cout << std::left << std::setw(24) << "mutex";
+        for (int threads : thread_counts) {
+            double ns = Run(threads, n, [&]() {
+                webserver::Mutex::Lock lock(mutex);
+                webserver::LogFormatter::ptr f = formatter;
+            });
+            std::cout << std::right << std::setw(9) << std::fixed << std::setprecision(1) << ns;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
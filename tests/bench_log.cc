@@ -0,0 +1,411 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../webserver/log.h"
+#include "../webserver/binlog.h"
+#include "../webserver/ratelimit.h"
+#include "../webserver/dedup_appender.h"
+#include "../webserver/uring_appender.h"
+#include "../webserver/escape.h"
+#include "../webserver/numfmt.h"
+#include <sstream>
+#include <random>
+#include <stdio.h>
+#include <charconv>
+#include <unistd.h>
+
+// 统计operator new的调用次数，用来验证稳定运行时日志路径不分配内存
+static std::atomic<size_t> s_alloc_count{0};
+
+void* operator new(size_t size) {
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// 只格式化、不输出的appender，排除IO的影响
+class NullLogAppender : public webserver::LogAppender {
+public:
+    void log(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event) override {
+        m_buf.clear();
+        m_formatter->format(m_buf, logger, level, event);
+        m_bytes += m_buf.size();
+    }
+    void logFormatted(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event,
+                      const char* data, size_t len) override {
+        m_bytes += len;
+    }
+    void write(const char* data, size_t len) override {
+        m_bytes += len;
+    }
+private:
+    std::string m_buf;
+    size_t m_bytes = 0;
+};
+
+// 可以被多个线程同时使用的appender：格式化到线程自己的缓冲区后丢弃
+class DiscardLogAppender : public webserver::LogAppender {
+public:
+    void log(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event) override {
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+    }
+    void logFormatted(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event,
+                      const char* data, size_t len) override {
+        asm volatile("" : : "r"(data), "r"(len) : "memory");
+    }
+    void write(const char* data, size_t len) override {
+    }
+};
+
+// 模拟写得慢的输出目标(比如磁盘卡顿)，每条日志忙等约2微秒
+class SlowLogAppender : public webserver::LogAppender {
+public:
+    void log(const webserver::Logger& logger, webserver::LogLevel::Level level, const webserver::LogEvent& event) override {
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+        while (std::chrono::steady_clock::now() < end) {
+        }
+    }
+    void write(const char* data, size_t len) override {
+    }
+};
+
+/*
+ * 先预热，再统计 每次调用耗时 和 每次调用的内存分配次数
+ * */
+template<class F>
+static void Bench(const char* name, size_t n, F f) {
+    for (size_t i = 0; i < 10000; ++i) {
+        f(i);
+    }
+    size_t allocs = s_alloc_count.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    allocs = s_alloc_count.load() - allocs;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / n;
+    std::cout << std::left << std::setw(40) << name
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << ns << " ns/op"
+              << std::setw(10) << std::setprecision(3) << (double)allocs / n << " allocs/op" << std::endl;
+}
+
+/*
+ * threads个线程同时执行，每个线程n次，统计平均每条的耗时(总墙钟时间/总条数)
+ * */
+template<class F>
+static void BenchThreads(const char* name, int threads, size_t n, F f) {
+    auto run = [&](size_t count) {
+        std::vector<std::thread> ts;
+        for (int t = 0; t < threads; ++t) {
+            ts.emplace_back([&f, count]() {
+                for (size_t i = 0; i < count; ++i) {
+                    f(i);
+                }
+            });
+        }
+        for (auto& t : ts) {
+            t.join();
+        }
+    };
+    run(10000);
+    auto start = std::chrono::steady_clock::now();
+    run(n);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (n * threads);
+    std::string label = std::string(name) + " x" + std::to_string(threads);
+    std::cout << std::left << std::setw(40) << label
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << ns << " ns/op" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    const size_t n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    webserver::Logger::ptr logger(new webserver::Logger("bench"));
+    webserver::LogAppender::ptr appender(new NullLogAppender);
+    appender->setFormatter(webserver::LogFormatter::ptr(
+            new webserver::LogFormatter("%d{%Y-%m-%d %H:%M:%S.%3N}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n")));
+    logger->addAppender(appender);
+
+    // 数字转文本：行号、线程号这类整数和消息里的浮点数，各种位数混在一起
+    std::vector<uint64_t> ints(1024);
+    std::vector<double> doubles(1024);
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i < ints.size(); ++i) {
+        ints[i] = rng() >> (rng() % 64);
+        doubles[i] = (double)(rng() % 1000000) / 1000;
+    }
+    char num[64];
+    std::ostringstream num_ss;
+    Bench("conv: int, ostream", n, [&](size_t i) {
+        num_ss.str("");
+        num_ss << ints[i & 1023];
+    });
+    Bench("conv: int, snprintf", n, [&](size_t i) {
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)ints[i & 1023]);
+    });
+    Bench("conv: int, std::to_chars", n, [&](size_t i) {
+        std::to_chars(num, num + sizeof(num), ints[i & 1023]);
+        asm volatile("" : : "r"(num) : "memory");
+    });
+    Bench("conv: int, FormatUInt", n, [&](size_t i) {
+        webserver::FormatUInt(num, ints[i & 1023]);
+        asm volatile("" : : "r"(num) : "memory");
+    });
+    Bench("conv: double, ostream", n, [&](size_t i) {
+        num_ss.str("");
+        num_ss << doubles[i & 1023];
+    });
+    Bench("conv: double, snprintf %.17g", n, [&](size_t i) {
+        snprintf(num, sizeof(num), "%.17g", doubles[i & 1023]);
+    });
+    Bench("conv: double, FormatDouble", n, [&](size_t i) {
+        webserver::FormatDouble(num, doubles[i & 1023]);
+        asm volatile("" : : "r"(num) : "memory");
+    });
+
+    // LogEvent 的创建与释放
+    Bench("event: new LogEvent", n, [&](size_t i) {
+        webserver::LogEvent::ptr e(new webserver::LogEvent(__FILE__, __LINE__, 0, 1, 2, time(0)));
+        e->getSS() << "request " << i << " done";
+    });
+    Bench("event: LogEvent::Create (pooled)", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->getSS() << "request " << i << " done";
+    });
+
+    // 完整的一次日志调用：创建事件、写消息、格式化
+    Bench("log: new LogEvent + format", n, [&](size_t i) {
+        webserver::LogEvent::ptr e(new webserver::LogEvent(__FILE__, __LINE__, 0, 1, 2, time(0)));
+        e->getSS() << "request " << i << " took " << 1.5 << " ms";
+        logger->info(e);
+    });
+    Bench("log: LogEvent::Create + format", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->getSS() << "request " << i << " took " << 1.5 << " ms";
+        logger->info(e);
+    });
+
+    // 结构化字段：同样的内容分别输出为文本和JSON
+    webserver::Logger::ptr json_logger(new webserver::Logger("json"));
+    webserver::LogAppender::ptr json_appender(new NullLogAppender);
+    json_appender->setFormatter(webserver::LogFormatter::ptr(new webserver::LogFormatter("%J%n")));
+    json_logger->addAppender(json_appender);
+    webserver::Logger::ptr kv_logger(new webserver::Logger("kv"));
+    webserver::LogAppender::ptr kv_appender(new NullLogAppender);
+    kv_appender->setFormatter(webserver::LogFormatter::ptr(
+            new webserver::LogFormatter("%d{%Y-%m-%d %H:%M:%S.%3N}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m %K%n")));
+    kv_logger->addAppender(kv_appender);
+    Bench("log: 3 fields, text %K", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->addField("request", i);
+        e->addField("took_ms", 1.5);
+        e->addField("path", "/api/login");
+        e->getSS() << "request done";
+        kv_logger->info(e);
+    });
+    Bench("log: 3 fields, JSON %J", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->addField("request", i);
+        e->addField("took_ms", 1.5);
+        e->addField("path", "/api/login");
+        e->getSS() << "request done";
+        json_logger->info(e);
+    });
+
+    // JSON转义：4KB的请求体，每512字节有一个引号，对比逐字节的查找和各个SIMD实现
+    std::string body;
+    for (size_t i = 0; i < 4096; ++i) {
+        body.push_back(i % 512 == 511 ? '"' : 'a' + i % 26);
+    }
+    std::string escaped;
+    escaped.reserve(body.size() * 2);
+    size_t escape_n = n / 10;
+    Bench("escape: 4KB body, bytewise", escape_n, [&](size_t i) {
+        escaped.clear();
+        const char* run = body.data();
+        for (const char* p = run; p < body.data() + body.size(); ++p) {
+            unsigned char c = *p;
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            escaped.append(run, p - run);
+            escaped.push_back('\\');
+            escaped.push_back(c);
+            run = p + 1;
+        }
+        escaped.append(run, body.data() + body.size() - run);
+    });
+    std::string default_impl = webserver::JsonEscapeImpl();
+    for (const char* impl : {"scalar", "sse2", "avx2"}) {
+        if (!webserver::SetJsonEscapeImpl(impl)) {
+            continue;
+        }
+        std::string name = std::string("escape: 4KB body, ") + impl;
+        Bench(name.c_str(), escape_n, [&](size_t i) {
+            escaped.clear();
+            webserver::AppendJsonEscaped(escaped, body);
+        });
+    }
+    webserver::SetJsonEscapeImpl(default_impl);
+    Bench("log: JSON %J, 4KB body", escape_n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->addField("request", i);
+        e->getSS() << body;
+        json_logger->info(e);
+    });
+
+    // 三个appender共用一个formatter，每条日志只格式化一次
+    webserver::Logger::ptr fanout_logger(new webserver::Logger("fanout"));
+    for (int i = 0; i < 3; ++i) {
+        webserver::LogAppender::ptr a(new NullLogAppender);
+        a->setFormatter(appender->getFormatter());
+        fanout_logger->addAppender(a);
+    }
+    Bench("log: 3 appenders, shared formatter", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->getSS() << "request " << i << " took " << 1.5 << " ms";
+        fanout_logger->info(e);
+    });
+
+    // 按级别过滤：8个appender里7个只收ERROR，INFO日志只查一次按级别分好的表
+    webserver::Logger::ptr level_logger(new webserver::Logger("level"));
+    for (int i = 0; i < 8; ++i) {
+        webserver::LogAppender::ptr a(new NullLogAppender);
+        a->setFormatter(appender->getFormatter());
+        a->setLevel(i == 0 ? webserver::LogLevel::DEBUG : webserver::LogLevel::ERROR);
+        level_logger->addAppender(a);
+    }
+    Bench("log: 8 appenders, 7 filtered by level", n, [&](size_t i) {
+        webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+        e->getSS() << "request " << i << " took " << 1.5 << " ms";
+        level_logger->info(e);
+    });
+
+    // 多线程写同一个logger：日志路径只传引用，不再修改logger和event的引用计数
+    webserver::Logger::ptr mt_logger(new webserver::Logger("mt"));
+    for (int i = 0; i < 3; ++i) {
+        webserver::LogAppender::ptr a(new DiscardLogAppender);
+        a->setFormatter(appender->getFormatter());
+        mt_logger->addAppender(a);
+    }
+    for (int threads : {1, 2, 4, 8}) {
+        BenchThreads("mt: log 3 appenders", threads, n / threads, [&](size_t i) {
+            webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+            e->getSS() << "request " << i << " took " << 1.5 << " ms";
+            mt_logger->info(std::move(e));
+        });
+    }
+    // 对照：按值传shared_ptr时每条日志的引用计数操作(shared_from_this、每个appender的logger和event)，
+    // logger被所有线程共享，它的计数所在的缓存行在核之间来回迁移
+    for (int threads : {1, 2, 4, 8}) {
+        BenchThreads("mt: by-value shared_ptr refcounts", threads, n / threads, [&](size_t i) {
+            static thread_local webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, 1, 2, time(0));
+            webserver::Logger::ptr self = mt_logger->shared_from_this();
+            for (int a = 0; a < 3; ++a) {
+                webserver::Logger::ptr logger = self;
+                webserver::LogEvent::ptr event = e;
+                asm volatile("" : : "r"(logger.get()), "r"(event.get()) : "memory");
+            }
+        });
+    }
+
+    // 异步队列满时的策略：消费者跟不上，看生产者每条日志的耗时
+    webserver::Logger::ptr full_logger(new webserver::Logger("full"));
+    full_logger->addAppender(webserver::LogAppender::ptr(new SlowLogAppender));
+    full_logger->setSpillFile("/tmp/bench_spill_log.txt");
+    full_logger->startAsync(1024);
+    const std::pair<const char*, webserver::Logger::OverflowPolicy> policies[] = {
+        {"async full: block", webserver::Logger::OVERFLOW_BLOCK},
+        {"async full: drop newest", webserver::Logger::OVERFLOW_DROP_NEWEST},
+        {"async full: drop below WARN", webserver::Logger::OVERFLOW_DROP_BELOW_LEVEL},
+        {"async full: spill to file", webserver::Logger::OVERFLOW_SPILL},
+    };
+    for (auto& p : policies) {
+        full_logger->setOverflowPolicy(p.second);
+        Bench(p.first, n, [&](size_t i) {
+            WEBSERVER_LOG_FMT_INFO(full_logger, "request {} took {} ms", i, 1.5);
+        });
+        full_logger->flush();
+    }
+    printf("async full: dropped %lu, spilled %lu\n", (unsigned long)full_logger->getDroppedCount(),
+           (unsigned long)full_logger->getSpilledCount());
+    full_logger->stopAsync();
+    unlink("/tmp/bench_spill_log.txt");
+
+    // 级别不够的日志宏：只有一次比较
+    logger->setLevel(webserver::LogLevel::ERROR);
+    Bench("macro: disabled INFO", n, [&](size_t i) {
+        WEBSERVER_LOG_INFO(logger) << "request " << i << " took " << 1.5 << " ms";
+    });
+    logger->setLevel(webserver::LogLevel::DEBUG);
+    Bench("macro: enabled INFO", n, [&](size_t i) {
+        WEBSERVER_LOG_INFO(logger) << "request " << i << " took " << 1.5 << " ms";
+    });
+    Bench("macro: FMT enabled INFO", n, [&](size_t i) {
+        WEBSERVER_LOG_FMT_INFO(logger, "request {} took {} ms", i, 1.5);
+    });
+
+    // 调用点限流：被拒绝的日志不创建事件、不格式化
+    webserver::LogRateLimiter::GetInstance()->setLimit("bench_log.cc:" + std::to_string(__LINE__ + 3),
+            webserver::LogRateLimit::Sample(1000));
+    Bench("macro: FMT INFO, sampled 1/1000", n, [&](size_t i) {
+        WEBSERVER_LOG_FMT_INFO(logger, "request {} took {} ms", i, 1.5);
+    });
+    webserver::LogRateLimiter::GetInstance()->setLimit("bench_log.cc:" + std::to_string(__LINE__ + 3),
+            webserver::LogRateLimit::TokenBucket(1000, 100));
+    Bench("macro: FMT INFO, 1000/s token bucket", n, [&](size_t i) {
+        WEBSERVER_LOG_FMT_INFO(logger, "request {} took {} ms", i, 1.5);
+    });
+
+    // 重复日志合并：重复的日志只算一次hash，不格式化、不分配内存
+    webserver::Logger::ptr dedup_logger(new webserver::Logger("dedup"));
+    dedup_logger->addAppender(webserver::LogAppender::ptr(new webserver::DedupLogAppender(appender)));
+    Bench("dedup: repeated message", n, [&](size_t i) {
+        WEBSERVER_LOG_ERROR(dedup_logger) << "connect to db failed: connection refused";
+    });
+
+    // 二进制日志：只编码调用点id和参数
+    webserver::BinLogger::ptr bin_logger(new webserver::BinLogger("bench", appender));
+    Bench("binlog: WEBSERVER_BINLOG_INFO", n, [&](size_t i) {
+        WEBSERVER_BINLOG_INFO(bin_logger, "request {} took {} ms", i, 1.5);
+    });
+
+    // 写文件：同一行日志分别经过FileLogAppender(write)和io_uring
+    std::string line = "2024-01-01 00:00:00.000\t1\tmain\t[INFO]\t[bench]\tbench_log.cc:100\trequest took 1.5 ms\n";
+    {
+        webserver::FileLogAppender::ptr file(new webserver::FileLogAppender("/tmp/bench_file_log.txt"));
+        Bench("file: FileLogAppender write", n, [&](size_t i) {
+            file->write(line.data(), line.size());
+        });
+        file->flush();
+    }
+    {
+        webserver::IoUringFileLogAppender::ptr uring(new webserver::IoUringFileLogAppender("/tmp/bench_uring_log.txt"));
+        Bench(uring->isUring() ? "file: IoUringFileLogAppender write" : "file: IoUringFileLogAppender(pwritev)", n, [&](size_t i) {
+            uring->write(line.data(), line.size());
+        });
+        uring->flush();
+    }
+    unlink("/tmp/bench_file_log.txt");
+    unlink("/tmp/bench_uring_log.txt");
+    return 0;
+}
@@ -1,19 +1,302 @@
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include "../webserver/log.h"
+#include "../webserver/async_appender.h"
+#include "../webserver/binlog.h"
+#include "../webserver/mmap_appender.h"
+#include "../webserver/uring_appender.h"
+#include "../webserver/ratelimit.h"
+#include "../webserver/dedup_appender.h"
+#include "../webserver/crash.h"
+#include "../webserver/log_config.h"
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
 
 int main(int argc, char** argv){   //  or : (int argc, int* argv[])
     // argc 是命令行的总参数个数
     // argv** 由argc个参数，其中第0个参数是程序全名，命令行后面跟的用户输入的参数
     // 添加新的appender
     webserver::Logger::ptr logger(new webserver::Logger);
-    logger->addAppender(webserver::Logger->addAppender(new webserver::StdoutAppender));
+    logger->addAppender(webserver::LogAppender::ptr(new webserver::StdoutLogAppender));
     
     // 添加新的event
     webserver::LogEvent::ptr event(new webserver::LogEvent(__FILE__, __LINE__, 0, 1, 2, time(0)));
 
-    logger->log(LogLevel::Level::DEBUG, event);
+    logger->log(webserver::LogLevel::DEBUG, event);
     
     std::cout << "my log" << std::endl;
 
+    // 日志宏：先判断级别，再构造事件
+    WEBSERVER_LOG_INFO(logger) << "test macro " << 1;
+    WEBSERVER_LOG_ERROR(logger) << "test macro error";
+    logger->setLevel(webserver::LogLevel::ERROR);
+    WEBSERVER_LOG_INFO(logger) << "this line should not be printed";
+    logger->setLevel(webserver::LogLevel::DEBUG);
+
+    // 格式化方式
+    WEBSERVER_LOG_FMT_INFO(logger, "user {} took {} ms, {{ok}}", 42, 3.25);
+    logger->warn("runtime format {} {}", "str", 7);
+
+    // 异步appender：包装一个文件appender，后台线程负责写盘
+    webserver::Logger::ptr async_logger(new webserver::Logger("async"));
+    webserver::AsyncLogAppender::ptr async_appender(new webserver::AsyncLogAppender(
+            webserver::LogAppender::ptr(new webserver::FileLogAppender("./async_log.txt"))));
+    async_logger->addAppender(async_appender);
+    for (int i = 0; i < 10; ++i) {
+        webserver::LogEvent::ptr e(new webserver::LogEvent(__FILE__, __LINE__, 0, 1, 2, time(0)));
+        e->getSS() << "async log " << i;
+        async_logger->log(webserver::LogLevel::INFO, e);
+    }
+    async_appender->flush();
+
+    // 异步logger：多个线程并发打日志，经MPSC队列交给单个消费者线程
+    webserver::Logger::ptr mt_logger(new webserver::Logger("mt"));
+    mt_logger->addAppender(webserver::LogAppender::ptr(new webserver::FileLogAppender("./mt_log.txt")));
+    mt_logger->startAsync(1024);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([mt_logger, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                webserver::LogEvent::ptr e = webserver::LogEvent::Create(__FILE__, __LINE__, 0, t, 0, time(0));
+                e->getSS() << "thread " << t << " log " << i;
+                mt_logger->info(e);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    mt_logger->flush();
+
+    // 线程号和线程名称：%t %N 取自线程缓存，打日志时不进内核
+    webserver::Logger::ptr thread_logger(new webserver::Logger("thread"));
+    webserver::LogAppender::ptr thread_appender(new webserver::FileLogAppender("./thread_log.txt"));
+    thread_appender->setFormatter(webserver::LogFormatter::ptr(new webserver::LogFormatter("%d%T%t%T%N%T[%p]%T%m%n")));
+    thread_logger->addAppender(thread_appender);
+    std::vector<std::thread> named_threads;
+    for (int t = 0; t < 4; ++t) {
+        named_threads.emplace_back([thread_logger, t]() {
+            webserver::SetThreadName("worker_" + std::to_string(t));
+            for (int i = 0; i < 10; ++i) {
+                WEBSERVER_LOG_INFO(thread_logger) << "thread " << t << " log " << i;
+            }
+        });
+    }
+    for (auto& th : named_threads) {
+        th.join();
+    }
+    thread_logger->flush();
+
+    // 按级别分流：ERROR及以上另外写一个文件，运行中调整级别后下一条日志生效
+    webserver::Logger::ptr level_logger(new webserver::Logger("level"));
+    level_logger->addAppender(webserver::LogAppender::ptr(new webserver::FileLogAppender("./level_all_log.txt")));
+    webserver::LogAppender::ptr error_appender(new webserver::FileLogAppender("./level_error_log.txt"));
+    error_appender->setLevel(webserver::LogLevel::ERROR);
+    level_logger->addAppender(error_appender);
+    WEBSERVER_LOG_INFO(level_logger) << "only in level_all_log.txt";
+    WEBSERVER_LOG_ERROR(level_logger) << "in both files";
+    error_appender->setLevel(webserver::LogLevel::WARN);
+    WEBSERVER_LOG_WARN(level_logger) << "in both files after setLevel(WARN)";
+    level_logger->flush();
+
+    // 二进制日志：只写调用点id和参数，用 bin/logdecode ./bin_log.dat 还原
+    webserver::BinLogger::ptr bin_logger(new webserver::BinLogger("bin",
+            webserver::LogAppender::ptr(new webserver::AsyncLogAppender(
+                    webserver::LogAppender::ptr(new webserver::FileLogAppender("./bin_log.dat"))))));
+    for (int i = 0; i < 3; ++i) {
+        WEBSERVER_BINLOG_INFO(bin_logger, "binary log {} pi={} name={}", i, 3.14, "abc");
+    }
+    WEBSERVER_BINLOG_ERROR(bin_logger, "binary log without args");
+    bin_logger->flush();
+
+    // mmap appender：日志直接拷贝进文件的映射窗口，窗口取得很小以便演示换窗口
+    webserver::Logger::ptr mmap_logger(new webserver::Logger("mmap"));
+    mmap_logger->addAppender(webserver::LogAppender::ptr(new webserver::MmapFileLogAppender(
+            "./mmap_log.txt", 4096, webserver::MmapFileLogAppender::SYNC_ASYNC)));
+    for (int i = 0; i < 200; ++i) {
+        WEBSERVER_LOG_FMT_INFO(mmap_logger, "mmap log {}", i);
+    }
+    mmap_logger->flush();
+
+    // 按大小切分，切出来的文件由后台线程压缩，只保留最新的3个
+    webserver::Logger::ptr rotate_logger(new webserver::Logger("rotate"));
+    webserver::FileLogAppender::ptr rotate_appender(new webserver::FileLogAppender("./rotate_log.txt"));
+    webserver::FileLogAppender::RotatePolicy policy;
+    policy.max_size = 1024;
+    policy.interval = webserver::FileLogAppender::ROTATE_DAILY;
+    policy.max_files = 3;
+    rotate_appender->setRotatePolicy(policy);
+    rotate_logger->addAppender(rotate_appender);
+    for (int i = 0; i < 100; ++i) {
+        WEBSERVER_LOG_FMT_INFO(rotate_logger, "rotate log {}", i);
+    }
+    rotate_logger->flush();
+
+    // io_uring appender：缓冲区取得很小以便演示多个写请求同时在途
+    webserver::Logger::ptr uring_logger(new webserver::Logger("uring"));
+    uring_logger->addAppender(webserver::LogAppender::ptr(new webserver::IoUringFileLogAppender(
+            "./uring_log.txt", 4096, 4, true)));
+    for (int i = 0; i < 200; ++i) {
+        WEBSERVER_LOG_FMT_INFO(uring_logger, "uring log {}", i);
+    }
+    uring_logger->flush();
+
+    // 运行时增删appender：日志线程读快照不加锁，主线程反复替换快照
+    webserver::Logger::ptr cow_logger(new webserver::Logger("cow"));
+    cow_logger->addAppender(webserver::LogAppender::ptr(new webserver::MmapFileLogAppender("./cow_log.txt")));
+    webserver::LogAppender::ptr extra(new webserver::MmapFileLogAppender("./cow_extra_log.txt"));
+    std::atomic<int> cow_done{0};
+    std::vector<std::thread> cow_threads;
+    for (int t = 0; t < 4; ++t) {
+        cow_threads.emplace_back([cow_logger, &cow_done, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                WEBSERVER_LOG_FMT_INFO(cow_logger, "cow thread {} log {}", t, i);
+            }
+            ++cow_done;
+        });
+    }
+    while (cow_done.load() < 4) {
+        cow_logger->addAppender(extra);
+        std::this_thread::yield();
+        cow_logger->delAppender(extra);
+        std::this_thread::yield();
+    }
+    for (auto& t : cow_threads) {
+        t.join();
+    }
+    cow_logger->flush();
+
+    // 调用点限流：前3条都记，之后每100条记一条，丢弃的条数汇总成一行
+    webserver::Logger::ptr limit_logger(new webserver::Logger("limit"));
+    limit_logger->addAppender(webserver::LogAppender::ptr(new webserver::StdoutLogAppender));
+    webserver::LogRateLimiter::GetInstance()->setLimit("test.cc:" + std::to_string(__LINE__ + 3),
+            webserver::LogRateLimit::FirstNEveryM(3, 100));
+    for (int i = 0; i < 1000; ++i) {
+        WEBSERVER_LOG_FMT_ERROR(limit_logger, "hot error path {}", i);
+    }
+    webserver::LogRateLimiter::GetInstance()->report(limit_logger);
+
+    // 合并连续重复的日志：依赖挂掉时同一条错误只输出一次加一行重复计数
+    webserver::Logger::ptr dedup_logger(new webserver::Logger("dedup"));
+    dedup_logger->addAppender(webserver::LogAppender::ptr(new webserver::DedupLogAppender(
+            webserver::LogAppender::ptr(new webserver::StdoutLogAppender))));
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 500; ++j) {
+            WEBSERVER_LOG_ERROR(dedup_logger) << "connect to db failed: connection refused";
+        }
+        WEBSERVER_LOG_INFO(dedup_logger) << "retry " << i;
+    }
+    WEBSERVER_LOG_ERROR(dedup_logger) << "connect to db failed: connection refused";
+    WEBSERVER_LOG_ERROR(dedup_logger) << "connect to db failed: connection refused";
+    dedup_logger->flush();
+
+    // 结构化字段：%J 每行输出一个JSON对象，字段保持原来的类型
+    webserver::Logger::ptr json_logger(new webserver::Logger("json"));
+    webserver::LogAppender::ptr json_appender(new webserver::StdoutLogAppender);
+    json_appender->setFormatter(webserver::LogFormatter::ptr(new webserver::LogFormatter("%J%n")));
+    json_logger->addAppender(json_appender);
+    WEBSERVER_LOG_INFO(json_logger).with("uid", 42).with("cost_ms", 1.5).with("path", "/api/\"login\"")
+            .with("ok", true) << "request done\n";
+    // %K 在文本格式里以 key=value 输出
+    webserver::LogAppender::ptr kv_appender(new webserver::StdoutLogAppender);
+    kv_appender->setFormatter(webserver::LogFormatter::ptr(new webserver::LogFormatter("[%p] %m %K%n")));
+    json_logger->delAppender(json_appender);
+    json_logger->addAppender(kv_appender);
+    WEBSERVER_LOG_WARN(json_logger).with("uid", 42).with("reason", "token expired") << "login failed";
+
+    // 异步队列满：队列取得很小，INFO在满时丢弃，WARN等待；丢弃的条数由消费者线程汇总成一行WARN
+    webserver::Logger::ptr overflow_logger(new webserver::Logger("overflow"));
+    overflow_logger->addAppender(webserver::LogAppender::ptr(new webserver::FileLogAppender("./overflow_log.txt")));
+    overflow_logger->setOverflowPolicy(webserver::Logger::OVERFLOW_DROP_BELOW_LEVEL, webserver::LogLevel::WARN);
+    overflow_logger->setOverflowReportInterval(10);
+    overflow_logger->startAsync(16);
+    std::vector<std::thread> overflow_threads;
+    for (int t = 0; t < 4; ++t) {
+        overflow_threads.emplace_back([overflow_logger, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                if (i % 1000 == 0) {
+                    WEBSERVER_LOG_FMT_WARN(overflow_logger, "overflow thread {} warn {}", t, i);
+                } else {
+                    WEBSERVER_LOG_FMT_INFO(overflow_logger, "overflow thread {} info {}", t, i);
+                }
+            }
+        });
+    }
+    for (auto& th : overflow_threads) {
+        th.join();
+    }
+    overflow_logger->stopAsync();
+    overflow_logger->flush();
+    std::cout << "overflow dropped " << overflow_logger->getDroppedCount() << " INFO logs" << std::endl;
+
+    // 配置文件热加载：线程一直在打日志，改配置文件后级别和格式在不重启的情况下生效
+    auto write_config = [](const char* level, const char* pattern) {
+        // 先写临时文件再rename，监视线程看到的总是完整的文件
+        std::ofstream ofs("./log_config.ini.tmp");
+        ofs << "formatter = " << pattern << "\n"
+            << "[appender.file]\n" << "type = file\n" << "file = ./config_log.txt\n"
+            << "[logger.app]\n" << "level = " << level << "\n" << "appenders = file\n";
+        ofs.close();
+        rename("./log_config.ini.tmp", "./log_config.ini");
+    };
+    webserver::LogManager* manager = webserver::LogManager::GetInstance();
+    write_config("warn", "%d%T[%p]%T%m%n");
+    manager->watch("./log_config.ini");
+    webserver::Logger::ptr app_logger = manager->getLogger("app");
+    std::atomic<bool> config_done{false};
+    std::thread config_thread([app_logger, &config_done]() {
+        for (int i = 0; !config_done.load(); ++i) {
+            WEBSERVER_LOG_FMT_INFO(app_logger, "config info {}", i);
+            WEBSERVER_LOG_FMT_WARN(app_logger, "config warn {}", i);
+        }
+    });
+    for (uint64_t n = 1; n <= 3; ++n) {
+        write_config(n % 2 ? "info" : "warn", n % 2 ? "%d%T[%p]%T%N%T%m%n" : "%d%T[%p]%T%m%n");
+        while (manager->getReloadCount() <= n) {
+            std::this_thread::yield();
+        }
+    }
+    config_done = true;
+    config_thread.join();
+    manager->stopWatch();
+    app_logger->flush();
+    std::cout << "log config reloaded " << manager->getReloadCount() << " times" << std::endl;
+
+    // 配置里的溢出策略：需要async_queue开启异步，spill需要spill_file，否则整份配置被拒绝
+    webserver::LogConfig spill_config;
+    std::string config_error;
+    webserver::LogConfig::Parse("[logger.spill]\noverflow = drop_newest\n", spill_config, config_error);
+    std::cout << "overflow without async_queue: " << config_error << std::endl;
+    webserver::LogConfig::Parse("[appender.file]\ntype = file\nfile = ./config_log.txt\n"
+            "[logger.spill]\nappenders = file\nasync_queue = 16\noverflow = spill\nspill_file = ./spill_log.txt\n",
+            spill_config, config_error);
+    manager->apply(spill_config, config_error);
+    webserver::Logger::ptr spill_logger = manager->getLogger("spill");
+    for (int i = 0; i < 1000; ++i) {
+        WEBSERVER_LOG_FMT_INFO(spill_logger, "spill info {}", i);
+    }
+    spill_logger->flush();
+    std::cout << "spill file " << spill_logger->getSpillFile() << " got " << spill_logger->getSpilledCount() << " logs" << std::endl;
+
+    // 崩溃处理：bin/test crash 时演示，日志还在异步队列和缓冲区里就崩溃，
+    // crash_log.txt 里应有崩溃前的全部日志，后面跟着信号和调用栈
+    if (argc > 1 && strcmp(argv[1], "crash") == 0) {
+        webserver::CrashHandler::Install();
+        webserver::Logger::ptr crash_logger(new webserver::Logger("crash"));
+        crash_logger->addAppender(webserver::LogAppender::ptr(new webserver::AsyncLogAppender(
+                webserver::LogAppender::ptr(new webserver::FileLogAppender("./crash_log.txt")),
+                4 * 1024 * 1024, 60000)));
+        crash_logger->startAsync();
+        webserver::CrashHandler::AddLogger(crash_logger);
+        for (int i = 0; i < 1000; ++i) {
+            WEBSERVER_LOG_FMT_INFO(crash_logger, "before crash {}", i);
+        }
+        volatile int* p = nullptr;
+        *p = 1;
+    }
+
     return 0;
 }
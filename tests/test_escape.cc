@@ -0,0 +1,78 @@
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../webserver/escape.h"
+
+// FindJsonEscape各实现和逐字节判断的结果对比，不一致时输出用例并返回非0
+
+static size_t FindBytewise(const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = data[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            return i;
+        }
+    }
+    return len;
+}
+
+static int s_failures = 0;
+
+static void Check(const char* impl, const char* data, size_t len) {
+    size_t expect = FindBytewise(data, len);
+    size_t got = webserver::FindJsonEscape(data, len);
+    if (got != expect && ++s_failures <= 10) {
+        std::cout << impl << ": len " << len << " expect " << expect << " got " << got << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    // 紧挨着边界的字节最容易让按字的借位判断出错
+    const unsigned char clean[] = {' ', '!', '#', '[', ']', 'a', 0x7f, 0x80, 0xa2, 0xdc, 0xff};
+    const unsigned char dirty[] = {0x00, 0x01, 0x1f, '"', '\\'};
+    std::vector<size_t> lengths;
+    for (size_t len = 0; len <= 33; ++len) {
+        lengths.push_back(len);
+    }
+    lengths.push_back(4096);
+
+    std::mt19937 rng(12345);
+    std::vector<char> buf(4096 + 64);
+    for (const char* impl : {"scalar", "sse2", "avx2"}) {
+        if (!webserver::SetJsonEscapeImpl(impl)) {
+            std::cout << impl << ": not supported, skipped" << std::endl;
+            continue;
+        }
+        for (size_t len : lengths) {
+            // 起始地址错开，覆盖不对齐的加载
+            for (size_t offset = 0; offset < 8; ++offset) {
+                char* data = buf.data() + offset;
+                for (unsigned char c : clean) {
+                    std::fill(data, data + len, (char)c);
+                    Check(impl, data, len);
+                    // 每个位置各放一个需要转义的字节
+                    for (size_t pos = 0; pos < len && (len < 64 || pos % 61 == 0 || pos + 64 > len); ++pos) {
+                        for (unsigned char d : dirty) {
+                            data[pos] = d;
+                            Check(impl, data, len);
+                        }
+                        data[pos] = c;
+                    }
+                }
+                for (int round = 0; round < 200; ++round) {
+                    for (size_t i = 0; i < len; ++i) {
+                        // 大多是干净的字节，偶尔出现一个需要转义的
+                        data[i] = rng() % 64 ? clean[rng() % sizeof(clean)] : dirty[rng() % sizeof(dirty)];
+                    }
+                    Check(impl, data, len);
+                }
+            }
+        }
+        std::cout << impl << ": checked" << std::endl;
+    }
+    if (s_failures) {
+        std::cout << s_failures << " mismatches" << std::endl;
+        return 1;
+    }
+    return 0;
+}
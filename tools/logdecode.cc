@@ -0,0 +1,38 @@
+#include <iostream>
+#include "../webserver/binlog.h"
+
+/*
+ * 把二进制日志还原成文本
+ * 用法: logdecode <binlog文件> [日志模板]
+ * 日志模板与 LogFormatter 相同，默认为 Logger 的默认模板
+ * */
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <binlog file> [pattern]" << std::endl;
+        return 1;
+    }
+    webserver::BinLogReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << reader.getError() << std::endl;
+        return 1;
+    }
+
+    std::string pattern = argc > 2 ? argv[2] : "%d{%Y-%m-%d %H:%M:%S.%6N} [%p] %f %l %m %n";
+    webserver::LogFormatter::ptr formatter(new webserver::LogFormatter(pattern));
+    // 只用来提供 %c 日志名称
+    webserver::Logger::ptr logger(new webserver::Logger(reader.getName()));
+
+    std::string buf;
+    webserver::LogLevel::Level level;
+    webserver::LogEvent::ptr event;
+    while (reader.next(level, event)) {
+        buf.clear();
+        formatter->format(buf, *logger, level, *event);
+        std::cout.write(buf.data(), buf.size());
+    }
+    if (!reader.getError().empty()) {
+        std::cerr << reader.getError() << std::endl;
+        return 1;
+    }
+    return 0;
+}
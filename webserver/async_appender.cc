@@ -0,0 +1,203 @@
+#include "async_appender.h"
+#include "crash.h"
+#include <string.h>
+#include <chrono>
+
+namespace webserver {
+
+    void AsyncLogAppender::Buffer::append(const char* data, size_t len) {
+        memcpy(m_data.get() + m_len, data, len);
+        m_len += len;
+    }
+
+    AsyncLogAppender::AsyncLogAppender(LogAppender::ptr backend, size_t buffer_size, int flush_interval_ms)
+            : m_backend(backend)
+            , m_bufferSize(buffer_size)
+            , m_flushInterval(flush_interval_ms)
+            , m_current(new Buffer(buffer_size))
+            , m_next(new Buffer(buffer_size)) {
+        // 格式化在前端线程完成，沿用被包装appender的formatter
+        m_formatter = backend->getFormatter();
+        m_buffers.reserve(16);
+        start();
+    }
+
+    AsyncLogAppender::~AsyncLogAppender() {
+        stop();
+    }
+
+    void AsyncLogAppender::start() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            return;
+        }
+        m_running = true;
+        m_thread = std::thread(&AsyncLogAppender::run, this);
+    }
+
+    void AsyncLogAppender::stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) {
+                return;
+            }
+            m_running = false;
+        }
+        m_cond.notify_one();
+        m_thread.join();   // 后台线程退出前会把剩余的数据写完
+    }
+
+    void AsyncLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        // 格式化到线程自己的缓冲区，再拷贝进共享的双缓冲
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+        write(buf.data(), buf.size());
+    }
+
+    void AsyncLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                        const char* data, size_t len) {
+        write(data, len);
+    }
+
+    void AsyncLogAppender::write(const char* data, size_t len) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (len > m_current->avail()) {
+            // 当前缓冲区写满，交给后台线程，换上备用缓冲区
+            if (m_current->length() > 0) {
+                m_buffers.push_back(std::move(m_current));
+                if (m_next) {
+                    m_current = std::move(m_next);
+                } else {
+                    m_current.reset(new Buffer(m_bufferSize));
+                }
+            }
+            // 单条日志比整块缓冲区还大，单独分配一块
+            if (len > m_current->avail()) {
+                Buffer::ptr big(new Buffer(len));
+                big->append(data, len);
+                m_buffers.push_back(std::move(big));
+                m_cond.notify_one();
+                return;
+            }
+            m_cond.notify_one();
+        }
+        m_current->append(data, len);
+    }
+
+    void AsyncLogAppender::flush() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            m_backend->flush();
+            return;
+        }
+        m_flushRequest = true;
+        m_cond.notify_one();
+        m_flushCond.wait(lock, [this]() { return !m_flushRequest || !m_running; });
+    }
+
+    void AsyncLogAppender::emergencyFlush() {
+        // 不加锁，按时间顺序：backend自己的缓冲 -> 正在写出的 -> 等待写出的 -> 当前的
+        m_backend->emergencyFlush();
+        for (size_t i = m_written.load(std::memory_order_acquire); i < m_writing.size(); ++i) {
+            const Buffer* buf = m_writing[i].get();
+            if (buf) {
+                m_backend->emergencyWrite(buf->data(), buf->length());
+            }
+        }
+        for (auto& i : m_buffers) {
+            const Buffer* buf = i.get();
+            if (buf) {
+                m_backend->emergencyWrite(buf->data(), buf->length());
+            }
+        }
+        const Buffer* buf = m_current.get();
+        if (buf) {
+            m_backend->emergencyWrite(buf->data(), buf->length());
+        }
+    }
+
+    void AsyncLogAppender::emergencyWrite(const char* data, size_t len) {
+        m_backend->emergencyWrite(data, len);
+    }
+
+    void AsyncLogAppender::run() {
+        SetThreadName("log_async");
+        int crash_slot = CrashHandler::RegisterWorker();
+        Buffer::ptr spare1(new Buffer(m_bufferSize));
+        Buffer::ptr spare2(new Buffer(m_bufferSize));
+        std::vector<Buffer::ptr>& to_write = m_writing;
+        to_write.reserve(16);
+
+        while (true) {
+            // 崩溃处理开始后停在这里，不再换出缓冲区
+            CrashHandler::CheckCrashing(crash_slot);
+            bool flush_request = false;
+            bool running = true;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_buffers.empty() && m_running && !m_flushRequest) {
+                    // 等待期间不碰缓冲区，崩溃处理不用等它
+                    // 醒来后先放开锁再检查是否在崩溃，停住时不要挡住还没停住的消费者线程
+                    CrashHandler::WorkerIdle(crash_slot);
+                    m_cond.wait_for(lock, std::chrono::milliseconds(m_flushInterval));
+                    lock.unlock();
+                    CrashHandler::WorkerBusy(crash_slot);
+                    lock.lock();
+                }
+                // 没写满的当前缓冲区也一并换出来，保证最多延迟一个刷新周期
+                if (m_current->length() > 0) {
+                    m_buffers.push_back(std::move(m_current));
+                    m_current = std::move(spare1);
+                }
+                if (!m_next) {
+                    m_next = std::move(spare2);
+                }
+                to_write.swap(m_buffers);
+                flush_request = m_flushRequest;
+                running = m_running;
+            }
+
+            // 锁外做IO，前端线程只会在交换缓冲区的瞬间和后台竞争
+            for (auto& buf : to_write) {
+                m_backend->write(buf->data(), buf->length());
+                m_written.fetch_add(1, std::memory_order_release);
+            }
+            if (!to_write.empty() || flush_request) {
+                m_backend->flush();
+            }
+
+            // 回收正常大小的缓冲区作为备用，避免反复分配
+            for (auto& buf : to_write) {
+                if (buf->capacity() != m_bufferSize) {
+                    continue;
+                }
+                if (!spare1) {
+                    buf->reset();
+                    spare1 = std::move(buf);
+                } else if (!spare2) {
+                    buf->reset();
+                    spare2 = std::move(buf);
+                }
+            }
+            to_write.clear();
+            m_written.store(0, std::memory_order_release);
+            if (!spare1) {
+                spare1.reset(new Buffer(m_bufferSize));
+            }
+            if (!spare2) {
+                spare2.reset(new Buffer(m_bufferSize));
+            }
+
+            if (flush_request) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_flushRequest = false;
+                m_flushCond.notify_all();
+            }
+            if (!running) {
+                break;
+            }
+        }
+        CrashHandler::UnregisterWorker(crash_slot);
+    }
+}
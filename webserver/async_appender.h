@@ -0,0 +1,94 @@
+#ifndef __WEBSERVER_ASYNC_APPENDER_H__
+#define __WEBSERVER_ASYNC_APPENDER_H__
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "log.h"
+
+namespace webserver {
+
+// 异步日志输出，双缓冲
+    /*
+     * 包装任意一个LogAppender
+     * 前端线程只把格式化好的日志拷贝进预先分配好的缓冲区
+     * 后台线程把写满的缓冲区整块换出来，顺序地交给被包装的appender写入
+     * 这样业务线程不会因为磁盘IO而阻塞
+     * */
+    class AsyncLogAppender : public LogAppender {
+    public:
+        typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+        /*
+         * backend 被包装的appender，真正负责输出
+         * buffer_size 单块缓冲区大小
+         * flush_interval_ms 缓冲区没写满时，后台线程最长等待多久刷一次
+         * */
+        AsyncLogAppender(LogAppender::ptr backend, size_t buffer_size = 4 * 1024 * 1024,
+                         int flush_interval_ms = 1000);
+        ~AsyncLogAppender();
+
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+
+        // 拷贝进当前缓冲区，不做任何IO
+        void write(const char* data, size_t len) override;
+
+        // 把已经写入的数据全部交给后台线程并等待其写完
+        void flush() override;
+
+        // 崩溃时把还在内存里的缓冲区直接交给backend输出
+        void emergencyFlush() override;
+        void emergencyWrite(const char* data, size_t len) override;
+
+        void start();
+        void stop();
+
+        LogAppender::ptr getBackend() const { return m_backend; }
+
+    private:
+        // 固定大小的缓冲区，构造时一次性分配
+        class Buffer {
+        public:
+            typedef std::unique_ptr<Buffer> ptr;
+            Buffer(size_t size) : m_data(new char[size]), m_size(size) {}
+
+            size_t capacity() const { return m_size; }
+            size_t avail() const { return m_size - m_len; }
+            size_t length() const { return m_len; }
+            const char* data() const { return m_data.get(); }
+            void append(const char* data, size_t len);
+            void reset() { m_len = 0; }
+        private:
+            std::unique_ptr<char[]> m_data;
+            size_t m_size;
+            size_t m_len = 0;
+        };
+
+        void run();   // 后台线程
+
+    private:
+        LogAppender::ptr m_backend;
+        size_t m_bufferSize;
+        int m_flushInterval;
+        bool m_running = false;
+        bool m_flushRequest = false;   // flush()等待后台线程写完
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;        // 通知后台线程
+        std::condition_variable m_flushCond;   // 通知flush()的调用者
+        Buffer::ptr m_current;                 // 前端正在写的缓冲区
+        Buffer::ptr m_next;                    // 备用缓冲区
+        std::vector<Buffer::ptr> m_buffers;    // 已写满，等待后台写出的缓冲区
+        std::thread m_thread;
+
+        // 后台线程正在写出的缓冲区，崩溃时从m_written之后的继续输出
+        std::vector<Buffer::ptr> m_writing;
+        std::atomic<size_t> m_written{0};
+    };
+}
+
+#endif
@@ -0,0 +1,374 @@
+#include "binlog.h"
+#include "util.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+namespace webserver {
+
+    // 调用点表只追加，读写都在锁内，注册只发生在每个调用点第一次执行时
+    static std::mutex& GetRegistryMutex() {
+        static std::mutex* s_mutex = new std::mutex;
+        return *s_mutex;
+    }
+
+    static std::vector<BinLogRegistry::Site>& GetRegistrySites() {
+        static std::vector<BinLogRegistry::Site>* s_sites = new std::vector<BinLogRegistry::Site>;
+        return *s_sites;
+    }
+
+    static std::atomic<uint32_t> s_site_count{0};
+
+    uint32_t BinLogRegistry::Register(const char* fmt, const char* file, int32_t line, LogLevel::Level level) {
+        std::lock_guard<std::mutex> lock(GetRegistryMutex());
+        auto& sites = GetRegistrySites();
+        Site site;
+        site.fmt = fmt;
+        site.file = file;
+        site.line = line;
+        site.level = level;
+        sites.push_back(site);
+        s_site_count.store(sites.size(), std::memory_order_release);
+        return sites.size() - 1;
+    }
+
+    uint32_t BinLogRegistry::Count() {
+        return s_site_count.load(std::memory_order_acquire);
+    }
+
+    void BinLogRegistry::GetSites(uint32_t begin, uint32_t end, std::vector<Site>& sites) {
+        std::lock_guard<std::mutex> lock(GetRegistryMutex());
+        auto& all = GetRegistrySites();
+        for (uint32_t i = begin; i < end && i < all.size(); ++i) {
+            sites.push_back(all[i]);
+        }
+    }
+
+    template<class T>
+    static inline void Put(std::string& buf, T v) {
+        buf.append((const char*)&v, sizeof(v));
+    }
+
+    static inline void PutString(std::string& buf, const char* str, uint32_t len) {
+        Put<uint32_t>(buf, len);
+        buf.append(str, len);
+    }
+
+    void BinLogEncode(std::string& buf, const char* str) {
+        if (!str) {
+            str = "(null)";
+        }
+        buf.push_back('s');
+        PutString(buf, str, strlen(str));
+    }
+
+    void BinLogEncode(std::string& buf, std::string_view str) {
+        buf.push_back('s');
+        PutString(buf, str.data(), str.size());
+    }
+
+    void BinLogEncode(std::string& buf, const std::string& str) {
+        buf.push_back('s');
+        PutString(buf, str.data(), str.size());
+    }
+
+    void BinLogEncode(std::string& buf, char c) {
+        buf.push_back('c');
+        buf.push_back(c);
+    }
+
+    void BinLogEncode(std::string& buf, bool b) {
+        buf.push_back('b');
+        buf.push_back(b ? 1 : 0);
+    }
+
+    void BinLogEncode(std::string& buf, double v) {
+        buf.push_back('d');
+        Put<double>(buf, v);
+    }
+
+    void BinLogEncode(std::string& buf, const void* p) {
+        buf.push_back('p');
+        Put<uint64_t>(buf, (uintptr_t)p);
+    }
+
+    void BinLogEncodeSigned(std::string& buf, int64_t v) {
+        buf.push_back('i');
+        Put<int64_t>(buf, v);
+    }
+
+    void BinLogEncodeUnsigned(std::string& buf, uint64_t v) {
+        buf.push_back('u');
+        Put<uint64_t>(buf, v);
+    }
+
+    BinLogger::BinLogger(const std::string& name, LogAppender::ptr out)
+            : m_name(name)
+            , m_out(out) {
+        std::string header(BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+        Put<uint8_t>(header, BINLOG_VERSION);
+        PutString(header, name.data(), name.size());
+        m_out->write(header.data(), header.size());
+    }
+
+    void BinLogger::writeNewSites(std::string& buf) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t begin = m_sitesWritten.load(std::memory_order_relaxed);
+        uint32_t end = BinLogRegistry::Count();
+        if (begin >= end) {
+            return;   // 别的线程已经写过了
+        }
+        std::vector<BinLogRegistry::Site> sites;
+        BinLogRegistry::GetSites(begin, end, sites);
+        for (size_t i = 0; i < sites.size(); ++i) {
+            auto& site = sites[i];
+            buf.push_back('S');
+            Put<uint32_t>(buf, begin + i);
+            Put<uint8_t>(buf, site.level);
+            Put<int32_t>(buf, site.line);
+            PutString(buf, site.file, strlen(site.file));
+            PutString(buf, site.fmt, strlen(site.fmt));
+        }
+        m_sitesWritten.store(end, std::memory_order_release);
+    }
+
+    void BinLogger::beginRecord(std::string& buf, uint32_t site, uint8_t nargs) {
+        uint64_t sec = 0;
+        uint32_t nsec = 0;
+        GetCurrentTime(sec, nsec);
+        buf.push_back('E');
+        Put<uint32_t>(buf, site);
+        Put<uint64_t>(buf, sec);
+        Put<uint32_t>(buf, nsec);
+        Put<uint32_t>(buf, GetThreadId());
+        Put<uint32_t>(buf, GetElapsedMS());
+        Put<uint8_t>(buf, nargs);
+    }
+
+    // 解码时的读取，越界返回false
+    template<class T>
+    static inline bool Get(const std::string& data, size_t& pos, T& v) {
+        if (pos + sizeof(T) > data.size()) {
+            return false;
+        }
+        memcpy(&v, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    static inline bool GetString(const std::string& data, size_t& pos, std::string_view& str) {
+        uint32_t len = 0;
+        if (!Get(data, pos, len) || pos + len > data.size()) {
+            return false;
+        }
+        str = std::string_view(data.data() + pos, len);
+        pos += len;
+        return true;
+    }
+
+    bool BinLogReader::open(const std::string& filename) {
+        std::ifstream ifs(filename, std::ios::binary);
+        if (!ifs) {
+            m_error = "open " + filename + " failed";
+            return false;
+        }
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        m_data = ss.str();
+
+        if (m_data.size() < sizeof(BINLOG_MAGIC) + 1
+                || memcmp(m_data.data(), BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+            m_error = "not a binary log file";
+            return false;
+        }
+        size_t pos = sizeof(BINLOG_MAGIC);
+        uint8_t version = 0;
+        std::string_view name;
+        Get(m_data, pos, version);
+        if (version != BINLOG_VERSION || !GetString(m_data, pos, name)) {
+            m_error = "unsupported binary log version";
+            return false;
+        }
+        m_name = std::string(name);
+        m_pos = pos;
+
+        // 第一遍：收集所有调用点，事件记录只跳过
+        while (pos < m_data.size()) {
+            char type = m_data[pos++];
+            if (type == 'S') {
+                if (!readSite(pos, true)) {
+                    break;
+                }
+            } else if (type == 'E') {
+                size_t head = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) * 3;
+                uint8_t nargs = 0;
+                pos += head;
+                if (!Get(m_data, pos, nargs)) {
+                    break;
+                }
+                bool ok = true;
+                for (uint8_t i = 0; i < nargs && ok; ++i) {
+                    ok = skipArg(pos);
+                }
+                if (!ok) {
+                    break;
+                }
+            } else {
+                break;   // 文件末尾写了一半的记录
+            }
+        }
+        return true;
+    }
+
+    bool BinLogReader::readSite(size_t& pos, bool store) {
+        uint32_t id = 0;
+        uint8_t level = 0;
+        int32_t line = 0;
+        std::string_view file;
+        std::string_view fmt;
+        if (!Get(m_data, pos, id) || !Get(m_data, pos, level) || !Get(m_data, pos, line)
+                || !GetString(m_data, pos, file) || !GetString(m_data, pos, fmt)) {
+            return false;
+        }
+        if (store) {
+            Site& site = m_sites[id];
+            site.level = (LogLevel::Level)level;
+            site.line = line;
+            site.file = std::string(file);
+            site.fmt = std::string(fmt);
+        }
+        return true;
+    }
+
+    bool BinLogReader::skipArg(size_t& pos) {
+        if (pos >= m_data.size()) {
+            return false;
+        }
+        char type = m_data[pos++];
+        switch (type) {
+            case 'i':
+            case 'u':
+            case 'd':
+            case 'p':
+                pos += 8;
+                break;
+            case 'c':
+            case 'b':
+                pos += 1;
+                break;
+            case 's': {
+                std::string_view str;
+                return GetString(m_data, pos, str);
+            }
+            default:
+                return false;
+        }
+        return pos <= m_data.size();
+    }
+
+    bool BinLogReader::decodeArg(size_t& pos, LogStream& ss) {
+        if (pos >= m_data.size()) {
+            return false;
+        }
+        char type = m_data[pos++];
+        switch (type) {
+            case 'i': {
+                int64_t v = 0;
+                if (!Get(m_data, pos, v)) return false;
+                ss << (long long)v;
+                break;
+            }
+            case 'u': {
+                uint64_t v = 0;
+                if (!Get(m_data, pos, v)) return false;
+                ss << (unsigned long long)v;
+                break;
+            }
+            case 'd': {
+                double v = 0;
+                if (!Get(m_data, pos, v)) return false;
+                ss << v;
+                break;
+            }
+            case 'p': {
+                uint64_t v = 0;
+                if (!Get(m_data, pos, v)) return false;
+                ss << (const void*)(uintptr_t)v;
+                break;
+            }
+            case 'c': {
+                char c = 0;
+                if (!Get(m_data, pos, c)) return false;
+                ss << c;
+                break;
+            }
+            case 'b': {
+                uint8_t b = 0;
+                if (!Get(m_data, pos, b)) return false;
+                ss << (bool)b;
+                break;
+            }
+            case 's': {
+                std::string_view str;
+                if (!GetString(m_data, pos, str)) return false;
+                ss << str;
+                break;
+            }
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    bool BinLogReader::next(LogLevel::Level& level, LogEvent::ptr& event) {
+        while (m_pos < m_data.size()) {
+            size_t pos = m_pos;
+            char type = m_data[pos++];
+            if (type == 'S') {
+                if (!readSite(pos, false)) {
+                    return false;
+                }
+                m_pos = pos;
+                continue;
+            }
+            if (type != 'E') {
+                return false;
+            }
+            uint32_t id = 0;
+            uint64_t sec = 0;
+            uint32_t nsec = 0;
+            uint32_t tid = 0;
+            uint32_t elapse = 0;
+            uint8_t nargs = 0;
+            if (!Get(m_data, pos, id) || !Get(m_data, pos, sec) || !Get(m_data, pos, nsec)
+                    || !Get(m_data, pos, tid) || !Get(m_data, pos, elapse) || !Get(m_data, pos, nargs)) {
+                return false;
+            }
+            auto it = m_sites.find(id);
+            if (it == m_sites.end()) {
+                m_error = "unknown call site " + std::to_string(id);
+                return false;
+            }
+            const Site& site = it->second;
+            event = LogEvent::Create(site.file.c_str(), site.line, elapse, tid, 0, sec, nsec);
+            level = site.level;
+
+            // 按格式串把参数填回去
+            LogStream& ss = event->getSS();
+            const char* fmt = site.fmt.c_str();
+            for (uint8_t i = 0; i < nargs; ++i) {
+                if (AppendFormatLiteral(ss, fmt)) {
+                    if (!decodeArg(pos, ss)) {
+                        return false;
+                    }
+                } else if (!skipArg(pos)) {
+                    return false;
+                }
+            }
+            FormatTo(ss, fmt);
+            m_pos = pos;
+            return true;
+        }
+        return false;
+    }
+}
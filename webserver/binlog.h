@@ -0,0 +1,182 @@
+#ifndef __WEBSERVER_BINLOG_H__
+#define __WEBSERVER_BINLOG_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include "log.h"
+
+/*
+ * 二进制日志(延迟格式化)
+ * 每个调用点第一次执行时把 格式串、文件名、行号、级别 注册一次，得到一个数字id
+ * 运行时只写 id + 时间 + 参数的原始字节，不做任何文本格式化
+ * 用 logdecode 工具按 LogFormatter 的模板把二进制文件还原成文本
+ *
+ * 例如 WEBSERVER_BINLOG_INFO(binlogger, "user {} took {} ms", id, ms);
+ * */
+#define WEBSERVER_BINLOG_LEVEL(binlogger, level, fmt, ...) \
+    do { \
+        if ((level) >= WEBSERVER_LOG_MIN_LEVEL && WEBSERVER_UNLIKELY((level) >= (binlogger)->getLevel())) { \
+            static const uint32_t s_binlog_site = webserver::BinLogRegistry::Register(fmt, __FILE__, __LINE__, level); \
+            (binlogger)->log<webserver::CountFormatArgs(fmt)>(s_binlog_site, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define WEBSERVER_BINLOG_DEBUG(binlogger, fmt, ...) WEBSERVER_BINLOG_LEVEL(binlogger, webserver::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define WEBSERVER_BINLOG_INFO(binlogger, fmt, ...) WEBSERVER_BINLOG_LEVEL(binlogger, webserver::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define WEBSERVER_BINLOG_WARN(binlogger, fmt, ...) WEBSERVER_BINLOG_LEVEL(binlogger, webserver::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define WEBSERVER_BINLOG_ERROR(binlogger, fmt, ...) WEBSERVER_BINLOG_LEVEL(binlogger, webserver::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define WEBSERVER_BINLOG_FATAL(binlogger, fmt, ...) WEBSERVER_BINLOG_LEVEL(binlogger, webserver::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace webserver {
+
+    /*
+     * 文件格式(小端)：
+     *   文件头  "WSBINLOG" u8版本 u32名称长度 logger名称
+     *   调用点  'S' u32 id, u8 level, i32 line, u32长度 文件名, u32长度 格式串
+     *   事件    'E' u32 id, u64 秒, u32 纳秒, u32 线程id, u32 启动毫秒数, u8 参数个数, 参数...
+     *   参数    u8类型 + 值：'i' i64, 'u' u64, 'd' double, 'c' char, 'b' u8,
+     *           'p' u64(指针), 's' u32长度 + 字节
+     * 调用点记录可能出现在引用它的事件之后，解码时先收集全部调用点
+     * */
+    static const char BINLOG_MAGIC[8] = {'W', 'S', 'B', 'I', 'N', 'L', 'O', 'G'};
+    static const uint8_t BINLOG_VERSION = 1;
+
+// 调用点注册表，进程内全局唯一
+    class BinLogRegistry {
+    public:
+        struct Site {
+            const char* fmt;
+            const char* file;
+            int32_t line;
+            LogLevel::Level level;
+        };
+
+        // 注册一个调用点，返回它的id(从0开始连续编号)
+        static uint32_t Register(const char* fmt, const char* file, int32_t line, LogLevel::Level level);
+        // 已注册的调用点个数
+        static uint32_t Count();
+        // 取[begin, end)范围内的调用点
+        static void GetSites(uint32_t begin, uint32_t end, std::vector<Site>& sites);
+    };
+
+// 参数编码，一个类型一个重载
+    void BinLogEncode(std::string& buf, const char* str);
+    void BinLogEncode(std::string& buf, std::string_view str);
+    void BinLogEncode(std::string& buf, const std::string& str);
+    void BinLogEncode(std::string& buf, char c);
+    void BinLogEncode(std::string& buf, bool b);
+    void BinLogEncode(std::string& buf, double v);
+    void BinLogEncode(std::string& buf, const void* p);
+    void BinLogEncodeSigned(std::string& buf, int64_t v);
+    void BinLogEncodeUnsigned(std::string& buf, uint64_t v);
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    BinLogEncode(std::string& buf, T v) {
+        BinLogEncodeSigned(buf, v);
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+    BinLogEncode(std::string& buf, T v) {
+        BinLogEncodeUnsigned(buf, v);
+    }
+
+    inline void BinLogEncode(std::string& buf, float v) {
+        BinLogEncode(buf, (double)v);
+    }
+
+// 二进制日志器
+    /*
+     * 编码好的记录通过 out->write() 整条输出，out一般是包装了FileLogAppender的AsyncLogAppender，
+     * 由它负责多线程下的缓冲和顺序写盘
+     * */
+    class BinLogger {
+    public:
+        typedef std::shared_ptr<BinLogger> ptr;
+
+        BinLogger(const std::string& name, LogAppender::ptr out);
+
+        /*
+         * 写一条日志，site 为注册得到的id
+         * N 是编译期算出的占位符个数，由 WEBSERVER_BINLOG_XXX 宏传入
+         * */
+        template<int N, class... Args>
+        void log(uint32_t site, const Args&... args) {
+            static_assert(N >= 0, "log format string has unmatched '{' or '}'");
+            static_assert(N == sizeof...(Args), "log format placeholders do not match the number of arguments");
+            static thread_local std::string buf;
+            buf.clear();
+            writeSites(buf);
+            beginRecord(buf, site, sizeof...(Args));
+            (BinLogEncode(buf, args), ...);
+            m_out->write(buf.data(), buf.size());
+        }
+
+        void flush() { m_out->flush(); }
+
+        LogLevel::Level getLevel() const { return m_level; }
+        void setLevel(LogLevel::Level val) { m_level = val; }
+        const std::string& getName() const { return m_name; }
+
+    private:
+        // 把还没写出过的调用点记录追加到buf
+        void writeSites(std::string& buf) {
+            if (WEBSERVER_UNLIKELY(m_sitesWritten.load(std::memory_order_acquire) < BinLogRegistry::Count())) {
+                writeNewSites(buf);
+            }
+        }
+        void writeNewSites(std::string& buf);
+        // 事件记录的固定头部：id、时间、线程号等
+        void beginRecord(std::string& buf, uint32_t site, uint8_t nargs);
+
+    private:
+        std::string m_name;
+        LogLevel::Level m_level = LogLevel::DEBUG;
+        LogAppender::ptr m_out;
+        std::mutex m_mutex;                       // 保护调用点记录只写一次
+        std::atomic<uint32_t> m_sitesWritten{0};  // 已经写进输出的调用点个数
+    };
+
+// 二进制日志解码
+    class BinLogReader {
+    public:
+        // 读入整个文件并收集调用点，失败返回false
+        bool open(const std::string& filename);
+
+        /*
+         * 按顺序取下一条事件，消息已经按格式串填好参数
+         * 文件结束或遇到损坏(比如崩溃时写了一半)返回false
+         * */
+        bool next(LogLevel::Level& level, LogEvent::ptr& event);
+
+        const std::string& getName() const { return m_name; }
+        const std::string& getError() const { return m_error; }
+
+    private:
+        struct Site {
+            LogLevel::Level level;
+            int32_t line;
+            std::string file;
+            std::string fmt;
+        };
+
+        bool readSite(size_t& pos, bool store);
+        bool skipArg(size_t& pos);
+        bool decodeArg(size_t& pos, LogStream& ss);
+
+    private:
+        std::string m_data;
+        size_t m_pos = 0;     // 下一条记录的位置
+        std::string m_name;
+        std::string m_error;
+        std::map<uint32_t, Site> m_sites;
+    };
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "crash.h"
+#include "numfmt.h"
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <vector>
+
+namespace webserver {
+
+    static const int CRASH_SIGNALS[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE};
+    static const int MAX_FRAMES = 64;
+    static const size_t ALT_STACK_SIZE = 64 * 1024;
+
+    // 信号处理函数只读这个数组，不碰持有所有权的vector
+    static std::atomic<Logger*> s_loggers[CrashHandler::MAX_LOGGERS];
+    static std::atomic<int> s_loggerCount{0};
+    static std::atomic<pid_t> s_crashingTid{0};   // 正在处理崩溃的线程
+
+    // 线程的备用信号栈，线程退出时先撤销再释放
+    struct ThreadAltStack {
+        char* stack = nullptr;
+        ~ThreadAltStack() {
+            if (stack) {
+                stack_t ss;
+                memset(&ss, 0, sizeof(ss));
+                ss.ss_flags = SS_DISABLE;
+                sigaltstack(&ss, nullptr);
+                delete[] stack;
+            }
+        }
+    };
+    static thread_local ThreadAltStack t_altStack;
+
+    // 后台线程的槽位：tid为0表示空闲
+    enum WorkerState : uint8_t {
+        WORKER_BUSY = 0,
+        WORKER_IDLE = 1,
+        WORKER_PARKED = 2,
+    };
+    static std::atomic<pid_t> s_workerTids[CrashHandler::MAX_WORKERS];
+    static std::atomic<uint8_t> s_workerStates[CrashHandler::MAX_WORKERS];
+
+    std::atomic<bool> CrashHandler::s_crashing{false};
+
+    static const char* SignalName(int sig) {
+        switch (sig) {
+            case SIGSEGV: return "SIGSEGV";
+            case SIGABRT: return "SIGABRT";
+            case SIGBUS: return "SIGBUS";
+            case SIGFPE: return "SIGFPE";
+        }
+        return "UNKNOWN";
+    }
+
+    // 在栈上拼一行文本，只用memcpy和numfmt.h的函数，可以在信号处理函数里使用
+    class CrashLine {
+    public:
+        CrashLine& append(const char* str) {
+            return append(str, strlen(str));
+        }
+
+        CrashLine& append(const char* str, size_t len) {
+            if (len > sizeof(m_buf) - m_len) {
+                len = sizeof(m_buf) - m_len;
+            }
+            memcpy(m_buf + m_len, str, len);
+            m_len += len;
+            return *this;
+        }
+
+        CrashLine& appendUInt(uint64_t val) {
+            char tmp[24];
+            return append(tmp, FormatUInt(tmp, val) - tmp);
+        }
+
+        CrashLine& appendHex(uint64_t val) {
+            char tmp[24];
+            append("0x");
+            return append(tmp, FormatHex(tmp, val) - tmp);
+        }
+
+        // 写到stderr和所有注册的logger
+        void emit() {
+            const char* p = m_buf;
+            size_t len = m_len;
+            while (len > 0) {
+                ssize_t n = ::write(STDERR_FILENO, p, len);
+                if (n <= 0) {
+                    break;
+                }
+                p += n;
+                len -= n;
+            }
+            int count = s_loggerCount.load(std::memory_order_acquire);
+            for (int i = 0; i < count; ++i) {
+                Logger* logger = s_loggers[i].load(std::memory_order_acquire);
+                if (logger) {
+                    logger->emergencyWrite(m_buf, m_len);
+                }
+            }
+            m_len = 0;
+        }
+
+    private:
+        char m_buf[1024];
+        size_t m_len = 0;
+    };
+
+    static uint64_t NowMS() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);   // 异步信号安全
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
+    /*
+     * 等其他登记过的后台线程停住或处于等待中
+     * 置标志和读状态都是seq_cst，和WorkerBusy里的 写状态+读标志 配对：
+     * 这里读到IDLE的线程醒来后一定能看到标志
+     * */
+    void CrashHandler::WaitWorkersParked(pid_t self) {
+        s_crashing.store(true, std::memory_order_seq_cst);
+        uint64_t deadline = NowMS() + MAX_PARK_WAIT_MS;
+        for (int i = 0; i < MAX_WORKERS; ++i) {
+            while (true) {
+                pid_t tid = s_workerTids[i].load(std::memory_order_seq_cst);
+                if (tid == 0 || tid == self
+                        || s_workerStates[i].load(std::memory_order_seq_cst) != WORKER_BUSY) {
+                    break;
+                }
+                if (NowMS() >= deadline) {
+                    return;   // 可能卡在崩溃线程持有的锁上，不再等
+                }
+                sched_yield();
+            }
+        }
+    }
+
+    static void WriteBacktrace() {
+        void* frames[MAX_FRAMES];
+        int n = backtrace(frames, MAX_FRAMES);
+        CrashLine line;
+        line.append("stack trace:\n").emit();
+        for (int i = 0; i < n; ++i) {
+            line.append("  #").appendUInt(i).append(" ").appendHex((uintptr_t)frames[i]);
+            Dl_info info;
+            // dladdr要拿动态链接器的锁，不是异步信号安全的，见crash.h
+            if (dladdr(frames[i], &info)) {
+                if (info.dli_sname) {
+                    line.append(" ").append(info.dli_sname)
+                        .append("+").appendHex((uintptr_t)frames[i] - (uintptr_t)info.dli_saddr);
+                }
+                if (info.dli_fname) {
+                    line.append(" (").append(info.dli_fname).append(")");
+                }
+            }
+            line.append("\n").emit();
+        }
+    }
+
+    void CrashHandler::OnSignal(int sig, siginfo_t* info, void* context) {
+        pid_t tid = syscall(SYS_gettid);
+        pid_t expected = 0;
+        if (!s_crashingTid.compare_exchange_strong(expected, tid)) {
+            if (expected == tid) {
+                // 处理过程中自己又崩溃了，直接按默认方式退出
+                signal(sig, SIG_DFL);
+                raise(sig);
+                return;
+            }
+            // 其他线程正在处理，等它结束进程
+            while (true) {
+                pause();
+            }
+        }
+
+        WaitWorkersParked(tid);
+
+        // 先刷出崩溃前的日志，再写崩溃信息，保持时间顺序
+        int count = s_loggerCount.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            Logger* logger = s_loggers[i].load(std::memory_order_acquire);
+            if (logger) {
+                logger->emergencyFlush();
+            }
+        }
+
+        CrashLine line;
+        line.append("*** caught signal ").appendUInt(sig).append(" (").append(SignalName(sig)).append(")");
+        if (sig != SIGABRT) {
+            line.append(" at address ").appendHex((uintptr_t)info->si_addr);
+        }
+        line.append(", thread ").appendUInt(tid).append(" ***\n").emit();
+        WriteBacktrace();
+
+        // 恢复默认处理后重新发出，信号在返回后投递，照常生成core
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    void CrashHandler::Install() {
+        static bool s_installed = false;
+        if (s_installed) {
+            return;
+        }
+        s_installed = true;
+
+        // backtrace第一次调用时会加载libgcc(要分配内存)，提前调用一次
+        void* frames[1];
+        backtrace(frames, 1);
+
+        InstallThread();
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = OnSignal;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        for (int sig : CRASH_SIGNALS) {
+            sigaction(sig, &sa, nullptr);
+        }
+    }
+
+    void CrashHandler::InstallThread() {
+        // 栈溢出时原来的栈已经不能用，在备用栈上处理
+        stack_t old;
+        if (t_altStack.stack || (sigaltstack(nullptr, &old) == 0 && !(old.ss_flags & SS_DISABLE))) {
+            return;
+        }
+        stack_t ss;
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_sp = new char[ALT_STACK_SIZE];
+        ss.ss_size = ALT_STACK_SIZE;
+        if (sigaltstack(&ss, nullptr) == 0) {
+            t_altStack.stack = (char*)ss.ss_sp;
+        } else {
+            delete[] (char*)ss.ss_sp;
+        }
+    }
+
+    int CrashHandler::RegisterWorker() {
+        InstallThread();
+        pid_t tid = GetThreadId();
+        for (int i = 0; i < MAX_WORKERS; ++i) {
+            pid_t expected = 0;
+            if (s_workerTids[i].load(std::memory_order_relaxed) == 0
+                    && s_workerTids[i].compare_exchange_strong(expected, tid)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void CrashHandler::UnregisterWorker(int slot) {
+        if (slot >= 0) {
+            // 空闲槽位的状态保持BUSY，下一个登记的线程一拿到就是忙的
+            s_workerStates[slot].store(WORKER_BUSY, std::memory_order_seq_cst);
+            s_workerTids[slot].store(0, std::memory_order_seq_cst);
+        }
+    }
+
+    void CrashHandler::WorkerIdle(int slot) {
+        if (slot >= 0) {
+            s_workerStates[slot].store(WORKER_IDLE, std::memory_order_seq_cst);
+        }
+    }
+
+    void CrashHandler::WorkerBusy(int slot) {
+        if (slot >= 0) {
+            s_workerStates[slot].store(WORKER_BUSY, std::memory_order_seq_cst);
+        }
+        if (s_crashing.load(std::memory_order_seq_cst)) {
+            Park(slot);
+        }
+    }
+
+    void CrashHandler::Park(int slot) {
+        if (slot >= 0) {
+            s_workerStates[slot].store(WORKER_PARKED, std::memory_order_seq_cst);
+        }
+        while (true) {
+            pause();   // 信号处理函数结束进程
+        }
+    }
+
+    bool CrashHandler::AddLogger(Logger::ptr logger) {
+        // 持有所有权直到进程退出，信号处理函数里用到时logger一定还在
+        static std::mutex* s_mutex = new std::mutex;
+        static std::vector<Logger::ptr>* s_owned = new std::vector<Logger::ptr>;
+        std::lock_guard<std::mutex> lock(*s_mutex);
+        int count = s_loggerCount.load(std::memory_order_relaxed);
+        if (count >= MAX_LOGGERS) {
+            return false;
+        }
+        s_owned->push_back(logger);
+        s_loggers[count].store(logger.get(), std::memory_order_release);
+        s_loggerCount.store(count + 1, std::memory_order_release);
+        return true;
+    }
+}
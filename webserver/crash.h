@@ -0,0 +1,80 @@
+#ifndef __WEBSERVER_CRASH_H__
+#define __WEBSERVER_CRASH_H__
+
+#include <atomic>
+#include <signal.h>
+#include <sys/types.h>
+#include "log.h"
+
+namespace webserver {
+
+// 崩溃处理
+    /*
+     * 捕获 SIGSEGV/SIGABRT/SIGBUS/SIGFPE，在信号处理函数里：
+     *   0. 置上崩溃标志，等日志的后台线程(Logger的消费者、AsyncLogAppender的写线程)停住，
+     *      否则它们会继续出队、换缓冲区，刚刷出去的位置之后的日志就丢了；
+     *      后台线程可能卡在崩溃线程持有的锁上，所以只等有限的时间
+     *   1. 把注册的logger还留在内存里的日志(appender缓冲区、异步队列)写出去
+     *   2. 把信号信息和调用栈写到stderr和这些logger
+     *   3. 恢复默认处理并重新raise，照常产生core dump和退出码
+     * 处理函数里只用write/pwrite这类系统调用和栈上的缓冲区，不加锁、不分配内存
+     * 调用栈用backtrace()+dladdr()取符号(链接时需要-rdynamic)，不做demangle
+     * 例外：dladdr不是异步信号安全的，要拿动态链接器的锁，崩溃发生在dlopen/dlclose当中时可能卡住
+     * 栈溢出只有在出事的线程设置过备用信号栈时才能处理，见InstallThread
+     * */
+    class CrashHandler {
+    public:
+        /*
+         * 安装信号处理函数，并给调用线程设置备用信号栈(栈溢出时也能运行)
+         * 重复调用只安装一次
+         * */
+        static void Install();
+
+        /*
+         * 给调用线程设置备用信号栈，线程退出时释放；已经有备用栈的线程不处理
+         * 备用栈是每个线程各自的，没有设置的线程栈溢出时处理函数会在溢出的栈上再次出错，
+         * 进程直接退出，缓冲区里的日志也来不及刷出；需要处理栈溢出的线程都应在开始时调用
+         * 日志库自己的后台线程在RegisterWorker里已经调用
+         * */
+        static void InstallThread();
+
+        /*
+         * 崩溃时需要刷出的logger，最多MAX_LOGGERS个，超出返回false
+         * logger之后不会释放
+         * */
+        static bool AddLogger(Logger::ptr logger);
+
+        static const int MAX_LOGGERS = 16;
+
+        /*
+         * 日志后台线程的登记，崩溃时信号处理函数等这些线程停住
+         * RegisterWorker 线程开始时调用，返回槽位，满了返回-1(崩溃时不等它)；同时调用InstallThread
+         * WorkerIdle     进入可能很长的等待前调用，等待期间不碰队列和缓冲区，崩溃处理不用等它
+         * WorkerBusy     等待结束后调用，崩溃处理已经开始时停在这里，不再返回
+         * CheckCrashing  每轮处理开始时调用，只有一次relaxed读
+         * */
+        static int RegisterWorker();
+        static void UnregisterWorker(int slot);
+        static void WorkerIdle(int slot);
+        static void WorkerBusy(int slot);
+        static void CheckCrashing(int slot) {
+            if (WEBSERVER_UNLIKELY(s_crashing.load(std::memory_order_relaxed))) {
+                Park(slot);
+            }
+        }
+
+        static const int MAX_WORKERS = 64;
+        static const int MAX_PARK_WAIT_MS = 200;   // 最多等后台线程多久
+
+    private:
+        static void OnSignal(int sig, siginfo_t* info, void* context);
+        // 标记为已停住，然后一直睡到进程退出
+        static void Park(int slot);
+        // 信号处理函数里调用：置上崩溃标志，等其他后台线程停住或处于等待中
+        static void WaitWorkersParked(pid_t self);
+
+        static std::atomic<bool> s_crashing;
+    };
+}
+
+#endif
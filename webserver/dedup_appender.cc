@@ -0,0 +1,103 @@
+#include "dedup_appender.h"
+#include "hash.h"
+
+namespace webserver {
+
+    DedupLogAppender::DedupLogAppender(LogAppender::ptr backend, int window_ms)
+            : m_backend(backend)
+            , m_windowMs(window_ms) {
+        m_formatter = backend->getFormatter();
+    }
+
+    bool DedupLogAppender::filter(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string_view content = event.getContentView();
+        // 调用点(文件名指针和行号)和级别作为种子
+        uint64_t seed = (uint64_t)(uintptr_t)event.getFile() ^ ((uint64_t)event.getLine() << 32) ^ level;
+        uint64_t hash = WyHash(content.data(), content.size(), seed);
+        const LogFields& fields = event.getFields();
+        if (!fields.empty()) {   // 字段不同也不算重复
+            hash = WyHash(fields.data(), fields.size(), hash);
+        }
+        uint64_t now_ms = event.getTime() * 1000 + event.getNsec() / 1000000;
+
+        if (m_hasLast && hash == m_hash && level == m_lastLevel && event.getLine() == m_line
+                && event.getFile() == m_file && now_ms - m_firstMs < m_windowMs) {
+            ++m_repeats;
+            m_repeatSec = event.getTime();
+            m_repeatNsec = event.getNsec();
+            m_repeatElapse = event.getElapse();
+            m_repeatThreadId = event.getThreadId();
+            m_repeatFiberId = event.getFiberId();
+            std::string_view name = event.getThreadName();
+            memcpy(m_repeatThreadName, name.data(), name.size());
+            m_repeatThreadNameLen = name.size();
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        if (m_repeats) {
+            emitRepeats(logger);
+        }
+        m_hasLast = true;
+        m_hash = hash;
+        m_lastLevel = level;
+        m_file = event.getFile();
+        m_line = event.getLine();
+        m_firstMs = now_ms;
+        if (m_loggerPtr != &logger) {
+            m_loggerPtr = &logger;
+            m_logger = logger.weak_from_this();
+        }
+        return false;
+    }
+
+    void DedupLogAppender::emitRepeats(const Logger& logger) {
+        // 事件放在栈上，消息写进LogStream的内联缓冲区，不分配内存
+        LogEvent event(m_file, m_line, m_repeatElapse, m_repeatThreadId, m_repeatFiberId,
+                       m_repeatSec, m_repeatNsec);
+        event.setThreadName(std::string_view(m_repeatThreadName, m_repeatThreadNameLen));
+        event.getSS() << "last message repeated " << m_repeats << " times";
+        m_repeats = 0;
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, m_lastLevel, event);
+        m_backend->logFormatted(logger, m_lastLevel, event, buf.data(), buf.size());
+    }
+
+    void DedupLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        PolicyMutex::Lock lock(m_mutex);   // 计数行和新日志的先后顺序也由这把锁保证
+        if (!filter(logger, level, event)) {
+            // 和AsyncLogAppender一样用自己的formatter，backend只负责输出
+            static thread_local std::string buf;
+            buf.clear();
+            m_formatter->format(buf, logger, level, event);
+            m_backend->logFormatted(logger, level, event, buf.data(), buf.size());
+        }
+    }
+
+    void DedupLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                        const char* data, size_t len) {
+        PolicyMutex::Lock lock(m_mutex);
+        if (!filter(logger, level, event)) {
+            m_backend->logFormatted(logger, level, event, data, len);
+        }
+    }
+
+    void DedupLogAppender::write(const char* data, size_t len) {
+        m_backend->write(data, len);
+    }
+
+    void DedupLogAppender::flush() {
+        {
+            PolicyMutex::Lock lock(m_mutex);
+            if (m_repeats) {
+                auto logger = m_logger.lock();
+                if (logger) {
+                    emitRepeats(*logger);
+                    m_hasLast = false;   // 计数行之后同样的日志重新输出
+                }
+            }
+        }
+        m_backend->flush();
+    }
+}
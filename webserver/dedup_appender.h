@@ -0,0 +1,73 @@
+#ifndef __WEBSERVER_DEDUP_APPENDER_H__
+#define __WEBSERVER_DEDUP_APPENDER_H__
+
+#include <memory>
+#include "log.h"
+
+namespace webserver {
+
+// 合并连续重复日志的Appender
+    /*
+     * 包装任意一个LogAppender，和上一条日志 内容+结构化字段+级别+调用点 相同的日志不再输出，只计数，
+     * 直到出现不同的日志、距离上次输出超过时间窗口或flush()时，
+     * 补一行 "last message repeated N times"
+     * 重复判断用内容的wyhash，过滤路径上不分配内存
+     * */
+    class DedupLogAppender : public LogAppender {
+    public:
+        typedef std::shared_ptr<DedupLogAppender> ptr;
+
+        /*
+         * backend 被包装的appender，真正负责输出
+         * window_ms 重复的日志最长合并多久，超过后即使还是同一条也会重新输出一次
+         * */
+        DedupLogAppender(LogAppender::ptr backend, int window_ms = 10000);
+
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+        // 已经格式化的文本无法判断重复，直接交给backend
+        void write(const char* data, size_t len) override;
+        // 输出积累的重复计数，再刷新backend
+        void flush() override;
+        // 崩溃时直接转给backend，不再补计数行
+        void emergencyFlush() override { m_backend->emergencyFlush(); }
+        void emergencyWrite(const char* data, size_t len) override { m_backend->emergencyWrite(data, len); }
+
+        // 被合并掉的日志总数
+        uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+
+    private:
+        // 是否是上一条的重复，是则计数并返回true；否则先补上重复计数行，再记下这一条
+        bool filter(const Logger& logger, LogLevel::Level level, const LogEvent& event);
+        void emitRepeats(const Logger& logger);
+
+    private:
+        LogAppender::ptr m_backend;
+        uint64_t m_windowMs;
+
+        // 上一条输出的日志
+        bool m_hasLast = false;
+        uint64_t m_hash = 0;
+        LogLevel::Level m_lastLevel = LogLevel::UNKNOWN;
+        const char* m_file = nullptr;
+        int32_t m_line = 0;
+        uint64_t m_firstMs = 0;                 // 这一轮输出的时间，用于判断窗口
+        const Logger* m_loggerPtr = nullptr;
+        std::weak_ptr<const Logger> m_logger;   // flush()时补计数行需要logger
+
+        // 最近一次重复的日志，计数行用它的时间和线程号
+        uint32_t m_repeats = 0;
+        uint64_t m_repeatSec = 0;
+        uint32_t m_repeatNsec = 0;
+        uint32_t m_repeatElapse = 0;
+        uint32_t m_repeatThreadId = 0;
+        uint32_t m_repeatFiberId = 0;
+        uint8_t m_repeatThreadNameLen = 0;
+        char m_repeatThreadName[THREAD_NAME_SIZE];
+
+        std::atomic<uint64_t> m_suppressed{0};
+    };
+}
+
+#endif
@@ -0,0 +1,171 @@
+#include "escape.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSERVER_ESCAPE_X86 1
+#endif
+
+namespace webserver {
+
+    static inline bool NeedJsonEscape(unsigned char c) {
+        return c < 0x20 || c == '"' || c == '\\';
+    }
+
+    // 一次判断8个字节：小于0x20，或者等于'"'/'\\'的字节，最高位会被置1
+    static size_t FindJsonEscapeScalar(const char* data, size_t len) {
+        const uint64_t ones = 0x0101010101010101ull;
+        const uint64_t highs = 0x8080808080808080ull;
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            uint64_t quote = w ^ (ones * '"');
+            uint64_t slash = w ^ (ones * '\\');
+            uint64_t hit = ((w - ones * 0x20) & ~w)
+                         | ((quote - ones) & ~quote)
+                         | ((slash - ones) & ~slash);
+            if (hit & highs) {
+                break;   // 这8个字节里有，逐个确认(借位可能让后面的字节误报)
+            }
+        }
+        for (; i < len; ++i) {
+            if (NeedJsonEscape(data[i])) {
+                return i;
+            }
+        }
+        return len;
+    }
+
+#ifdef WEBSERVER_ESCAPE_X86
+    // v <= 0x1f 用无符号min实现：min(v, 0x1f) == v
+    static inline int EscapeMask16(__m128i v) {
+        __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+        __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+        return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, slash), ctrl));
+    }
+
+    static size_t FindJsonEscapeSse2(const char* data, size_t len) {
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16) {
+            int mask = EscapeMask16(_mm_loadu_si128((const __m128i*)(data + i)));
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + FindJsonEscapeScalar(data + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    static size_t FindJsonEscapeAvx2(const char* data, size_t len) {
+        const __m256i quote_c = _mm256_set1_epi8('"');
+        const __m256i slash_c = _mm256_set1_epi8('\\');
+        const __m256i ctrl_c = _mm256_set1_epi8(0x1f);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            __m256i quote = _mm256_cmpeq_epi8(v, quote_c);
+            __m256i slash = _mm256_cmpeq_epi8(v, slash_c);
+            __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl_c), v);
+            uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(quote, slash), ctrl));
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + FindJsonEscapeSse2(data + i, len - i);
+    }
+#endif
+
+    typedef size_t (*FindFunc)(const char*, size_t);
+
+    struct EscapeImpl {
+        const char* name;
+        FindFunc func;
+        bool (*supported)();
+    };
+
+    static bool Always() { return true; }
+#ifdef WEBSERVER_ESCAPE_X86
+    static bool HasAvx2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+    // 按优先级排列
+    static const EscapeImpl s_impls[] = {
+#ifdef WEBSERVER_ESCAPE_X86
+        {"avx2", FindJsonEscapeAvx2, HasAvx2},
+        {"sse2", FindJsonEscapeSse2, Always},
+#endif
+        {"scalar", FindJsonEscapeScalar, Always},
+    };
+
+    static size_t FindJsonEscapeResolve(const char* data, size_t len);
+
+    // 第一次调用时选好实现，之后只是一次间接调用
+    static std::atomic<const EscapeImpl*> s_impl{nullptr};
+    static std::atomic<FindFunc> s_find{FindJsonEscapeResolve};
+
+    static const EscapeImpl* SelectImpl() {
+        for (auto& impl : s_impls) {
+            if (impl.supported()) {
+                return &impl;
+            }
+        }
+        return &s_impls[sizeof(s_impls) / sizeof(s_impls[0]) - 1];
+    }
+
+    static size_t FindJsonEscapeResolve(const char* data, size_t len) {
+        const EscapeImpl* impl = SelectImpl();
+        s_impl.store(impl, std::memory_order_relaxed);
+        s_find.store(impl->func, std::memory_order_relaxed);
+        return impl->func(data, len);
+    }
+
+    size_t FindJsonEscape(const char* data, size_t len) {
+        return s_find.load(std::memory_order_relaxed)(data, len);
+    }
+
+    const char* JsonEscapeImpl() {
+        const EscapeImpl* impl = s_impl.load(std::memory_order_relaxed);
+        return (impl ? impl : SelectImpl())->name;
+    }
+
+    bool SetJsonEscapeImpl(const std::string& name) {
+        for (auto& impl : s_impls) {
+            if (name == impl.name && impl.supported()) {
+                s_impl.store(&impl, std::memory_order_relaxed);
+                s_find.store(impl.func, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void AppendJsonEscaped(std::string& out, std::string_view str) {
+        static const char* s_hex = "0123456789abcdef";
+        const char* p = str.data();
+        size_t len = str.size();
+        while (true) {
+            size_t n = FindJsonEscape(p, len);
+            out.append(p, n);   // 干净的部分整段拷贝
+            if (n == len) {
+                break;
+            }
+            unsigned char c = p[n];
+            switch (c) {
+                case '"': out.append("\\\"", 2); break;
+                case '\\': out.append("\\\\", 2); break;
+                case '\n': out.append("\\n", 2); break;
+                case '\r': out.append("\\r", 2); break;
+                case '\t': out.append("\\t", 2); break;
+                default: {
+                    char esc[6] = {'\\', 'u', '0', '0', s_hex[c >> 4], s_hex[c & 0xf]};
+                    out.append(esc, 6);
+                }
+            }
+            p += n + 1;
+            len -= n + 1;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef __WEBSERVER_ESCAPE_H__
+#define __WEBSERVER_ESCAPE_H__
+
+#include <stddef.h>
+#include <string>
+#include <string_view>
+
+namespace webserver {
+
+// 字符串转义
+    /*
+     * 需要转义的字节(引号、反斜杠、0x20以下的控制字符)在日志里很少，
+     * 所以先整块地找下一个需要转义的位置，中间干净的部分一次拷贝
+     * 查找按CPU选择实现，第一次调用时决定：
+     *   avx2   每次比较32字节
+     *   sse2   每次比较16字节(x86-64都支持)
+     *   scalar 每次比较8字节(一个uint64里并行判断)，其他平台使用
+     * */
+
+    // 返回第一个需要JSON转义的字节的下标，没有则返回len
+    size_t FindJsonEscape(const char* data, size_t len);
+
+    // 把str按JSON字符串的规则转义后追加到out，不含两边的引号
+    void AppendJsonEscaped(std::string& out, std::string_view str);
+
+    // 当前使用的实现："avx2" "sse2" "scalar"
+    const char* JsonEscapeImpl();
+
+    // 指定实现，用于测试和基准对比；CPU不支持时返回false
+    bool SetJsonEscapeImpl(const std::string& name);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __WEBSERVER_HASH_H__
+#define __WEBSERVER_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "macro.h"
+
+namespace webserver {
+
+// wyhash (final4)，短文本上只需几次64位乘法，不分配内存，不适合做加密用途
+    namespace wyhash_detail {
+        static const uint64_t SECRET[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                           0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+        static inline void Mum(uint64_t* a, uint64_t* b) {
+            __uint128_t r = *a;
+            r *= *b;
+            *a = (uint64_t)r;
+            *b = (uint64_t)(r >> 64);
+        }
+
+        static inline uint64_t Mix(uint64_t a, uint64_t b) {
+            Mum(&a, &b);
+            return a ^ b;
+        }
+
+        static inline uint64_t Read8(const uint8_t* p) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            return v;
+        }
+
+        static inline uint64_t Read4(const uint8_t* p) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return v;
+        }
+
+        static inline uint64_t Read3(const uint8_t* p, size_t k) {
+            return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+        }
+    }
+
+    static inline uint64_t WyHash(const void* key, size_t len, uint64_t seed = 0) {
+        using namespace wyhash_detail;
+        const uint8_t* p = (const uint8_t*)key;
+        seed ^= Mix(seed ^ SECRET[0], SECRET[1]);
+        uint64_t a;
+        uint64_t b;
+        if (WEBSERVER_LIKELY(len <= 16)) {
+            if (WEBSERVER_LIKELY(len >= 4)) {
+                a = (Read4(p) << 32) | Read4(p + ((len >> 3) << 2));
+                b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - ((len >> 3) << 2));
+            } else if (WEBSERVER_LIKELY(len > 0)) {
+                a = Read3(p, len);
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+        } else {
+            size_t i = len;
+            if (WEBSERVER_UNLIKELY(i >= 48)) {
+                uint64_t see1 = seed;
+                uint64_t see2 = seed;
+                do {
+                    seed = Mix(Read8(p) ^ SECRET[1], Read8(p + 8) ^ seed);
+                    see1 = Mix(Read8(p + 16) ^ SECRET[2], Read8(p + 24) ^ see1);
+                    see2 = Mix(Read8(p + 32) ^ SECRET[3], Read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (WEBSERVER_LIKELY(i >= 48));
+                seed ^= see1 ^ see2;
+            }
+            while (WEBSERVER_UNLIKELY(i > 16)) {
+                seed = Mix(Read8(p) ^ SECRET[1], Read8(p + 8) ^ seed);
+                i -= 16;
+                p += 16;
+            }
+            a = Read8(p + i - 16);
+            b = Read8(p + i - 8);
+        }
+        a ^= SECRET[1];
+        b ^= seed;
+        Mum(&a, &b);
+        return Mix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+    }
+}
+
+#endif
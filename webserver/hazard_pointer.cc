@@ -0,0 +1,126 @@
+#include "hazard_pointer.h"
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace webserver {
+
+    // 所有保护记录组成的单链表，只增不减
+    static std::atomic<HazardRecord*> s_records{nullptr};
+
+    // 每个线程缓存几条自己用过的记录，嵌套保护(比如appender里又打日志)时依次取用
+    static const int LOCAL_RECORDS = 4;
+
+    struct LocalRecords {
+        HazardRecord* records[LOCAL_RECORDS];
+        int count = 0;
+        bool guard = false;
+        bool dead = false;
+    };
+
+    static thread_local LocalRecords t_local;
+
+    // 线程退出时把缓存的记录还回去
+    struct LocalGuard {
+        ~LocalGuard() {
+            LocalRecords& local = t_local;
+            for (int i = 0; i < local.count; ++i) {
+                local.records[i]->active.store(false, std::memory_order_release);
+            }
+            local.count = 0;
+            local.dead = true;
+        }
+    };
+
+    static HazardRecord* AcquireRecord() {
+        LocalRecords& local = t_local;
+        if (local.count > 0) {
+            return local.records[--local.count];
+        }
+        if (!local.guard && !local.dead) {
+            static thread_local LocalGuard s_guard;
+            (void)s_guard;
+            local.guard = true;
+        }
+        // 复用别的线程退出后留下的记录
+        for (HazardRecord* r = s_records.load(std::memory_order_acquire); r; r = r->next) {
+            bool expected = false;
+            if (!r->active.load(std::memory_order_relaxed)
+                    && r->active.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return r;
+            }
+        }
+        HazardRecord* r = new HazardRecord;
+        r->active.store(true, std::memory_order_relaxed);
+        HazardRecord* head = s_records.load(std::memory_order_relaxed);
+        do {
+            r->next = head;
+        } while (!s_records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+        return r;
+    }
+
+    static void ReleaseRecord(HazardRecord* r) {
+        r->ptr.store(nullptr, std::memory_order_release);
+        LocalRecords& local = t_local;
+        if (!local.dead && local.count < LOCAL_RECORDS) {
+            local.records[local.count++] = r;
+        } else {
+            r->active.store(false, std::memory_order_release);
+        }
+    }
+
+    HazardPointer::HazardPointer()
+        : m_record(AcquireRecord()) {
+    }
+
+    HazardPointer::~HazardPointer() {
+        ReleaseRecord(m_record);
+    }
+
+    // 等待释放的对象，只有写者会访问，写操作本身就不频繁，用锁即可
+    struct Retired {
+        const void* ptr;
+        void (*deleter)(const void*);
+    };
+
+    static std::mutex& GetRetiredMutex() {
+        static std::mutex* s_mutex = new std::mutex;
+        return *s_mutex;
+    }
+
+    static std::vector<Retired>& GetRetired() {
+        static std::vector<Retired>* s_retired = new std::vector<Retired>;
+        return *s_retired;
+    }
+
+    void HazardRetire(const void* p, void (*deleter)(const void*)) {
+        if (!p) {
+            return;
+        }
+        std::vector<Retired> to_free;
+        {
+            std::lock_guard<std::mutex> lock(GetRetiredMutex());
+            auto& retired = GetRetired();
+            retired.push_back({p, deleter});
+
+            // 收集当前所有被保护的指针，不在其中的都可以释放
+            std::vector<const void*> hazards;
+            for (HazardRecord* r = s_records.load(std::memory_order_acquire); r; r = r->next) {
+                const void* h = r->ptr.load(std::memory_order_seq_cst);
+                if (h) {
+                    hazards.push_back(h);
+                }
+            }
+            std::sort(hazards.begin(), hazards.end());
+            auto it = std::partition(retired.begin(), retired.end(), [&hazards](const Retired& r) {
+                return std::binary_search(hazards.begin(), hazards.end(), r.ptr);
+            });
+            to_free.assign(it, retired.end());
+            retired.erase(it, retired.end());
+        }
+        // 在锁外释放，deleter里可能再次retire
+        for (auto& r : to_free) {
+            r.deleter(r.ptr);
+        }
+    }
+}
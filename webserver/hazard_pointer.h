@@ -0,0 +1,64 @@
+#ifndef __WEBSERVER_HAZARD_POINTER_H__
+#define __WEBSERVER_HAZARD_POINTER_H__
+
+#include <atomic>
+#include "ring_buffer.h"
+
+namespace webserver {
+
+// 危险指针(hazard pointer)
+    /*
+     * 用于"读多写少、读者不加锁"的共享对象：写者发布新对象后把旧对象retire，
+     * 旧对象要等到没有任何读者还在使用时才真正释放
+     * 读者：HazardPointer hp; T* p = hp.protect(src); ...使用p... hp析构时解除保护
+     * 写者：old = src.exchange(new_obj); HazardRetire(old);
+     * 每条保护记录独占一条cache line，线程退出后记录留给别的线程复用
+     * 读路径只有一次store和一次load，没有锁也没有引用计数
+     * */
+    struct HazardRecord {
+        alignas(CACHE_LINE_SIZE) std::atomic<const void*> ptr{nullptr};
+        std::atomic<bool> active{false};
+        HazardRecord* next = nullptr;
+    };
+
+    class HazardPointer {
+    public:
+        HazardPointer();
+        ~HazardPointer();
+
+        HazardPointer(const HazardPointer&) = delete;
+        HazardPointer& operator=(const HazardPointer&) = delete;
+
+        // 读出src并保护它，返回的指针在reset()或析构前不会被释放
+        template<class T>
+        T* protect(const std::atomic<T*>& src) {
+            T* p = src.load(std::memory_order_acquire);
+            while (true) {
+                m_record->ptr.store(p, std::memory_order_seq_cst);
+                // 发布保护之后再确认一次，期间被替换的话重来
+                T* q = src.load(std::memory_order_seq_cst);
+                if (q == p) {
+                    return p;
+                }
+                p = q;
+            }
+        }
+
+        void reset() {
+            m_record->ptr.store(nullptr, std::memory_order_release);
+        }
+
+    private:
+        HazardRecord* m_record;
+    };
+
+    // 退休一个对象，没有被任何HazardPointer保护时调用deleter释放
+    void HazardRetire(const void* p, void (*deleter)(const void*));
+
+    template<class T>
+    void HazardRetire(const T* p) {
+        HazardRetire(p, [](const void* x) { delete (const T*)x; });
+    }
+}
+
+#endif
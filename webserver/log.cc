@@ -1,9 +1,22 @@
 #include "log.h"
+#include "util.h"
+#include "rotate.h"
+#include "hazard_pointer.h"
+#include "escape.h"
+#include "crash.h"
 #include <map>
 #include <iostream>
-#include <functional>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <charconv>
+#include <cmath>
 
 
 namespace webserver {
@@ -28,204 +41,1017 @@ namespace webserver {
         return "UNKNOWN";
     }
 
-    class MessageFormatItem : public LogFormatter::FormatItem {
-    public:
-        MessageFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getContent();
-        }
-    };
-
-    class LevelFormatItem : public LogFormatter::FormatItem {
-    public:
-        LevelFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << LogLevel::ToString(level);
-        }
-    };
+    LogLevel::Level LogLevel::FromString(const std::string& str) {
+        #define XX(level, v) \
+            if (strcasecmp(str.c_str(), #v) == 0) { \
+                return LogLevel::level; \
+            }
+            XX(DEBUG, debug);
+            XX(INFO, info);
+            XX(WARN, warn);
+            XX(ERROR, error);
+            XX(FATAL, fatal);
+        #undef XX
+        return LogLevel::UNKNOWN;
+    }
 
-    class ElapseFormatItem : public LogFormatter::FormatItem {
-    public:
-        ElapseFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getElapse();
+    LogStream& LogStream::operator<<(const void* p) {
+        if (m_size + 24 > m_cap) {
+            grow(m_size + 24);
         }
-    };
+        m_data[m_size++] = '0';
+        m_data[m_size++] = 'x';
+        m_size = FormatHex(m_data + m_size, (uintptr_t)p) - m_data;
+        return *this;
+    }
 
-    // 日志器的名称，formatter拿不到日志器名称，直接把logger往下传
-    class NameFormatItem : public LogFormatter::FormatItem {
-    public:
-        NameFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << logger->getName();
+    LogStream& LogStream::appendDouble(double v) {
+        if (m_size + 32 > m_cap) {
+            grow(m_size + 32);
         }
-    };
+        m_size = FormatDouble(m_data + m_size, v) - m_data;
+        return *this;
+    }
 
-    // 线程id
-    class ThreadIdFormatItem : public LogFormatter::FormatItem {
-    public:
-        ThreadIdFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getThreadId();
+    void LogStream::grow(size_t need) {
+        size_t cap = m_cap * 2;
+        while (cap < need) {
+            cap *= 2;
         }
-    };
-
-    // 协程id
-    class FiberIdFormatItem : public LogFormatter::FormatItem {
-    public:
-        FiberIdFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getFiberId();
+        char* data = new char[cap];
+        memcpy(data, m_data, m_size);
+        if (m_data != m_inline) {
+            delete[] m_data;
         }
-    };
+        m_data = data;
+        m_cap = cap;
+    }
 
-    // 时间
-    class DataTimeFormatItem : public LogFormatter::FormatItem {
-    public:
-        DataTimeFormatItem(const std::string format = "%Y-%m-%d %H:%M:%S")
-                :m_format(format){
+    void LogFields::grow(size_t need) {
+        size_t cap = m_cap * 2;
+        while (cap < need) {
+            cap *= 2;
         }
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getThreadId();
+        char* data = new char[cap];
+        memcpy(data, m_data, m_size);
+        if (m_data != m_inline) {
+            delete[] m_data;
         }
-    private:
-        std::string m_format;  // 时间的格式
-    };
+        m_data = data;
+        m_cap = cap;
+    }
 
-    // 文件名
-    class FileNameFormatItem : public LogFormatter::FormatItem {
-    public:
-        FileNameFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getFile();
+    bool AppendFormatLiteral(LogStream& ss, const char*& fmt) {
+        const char* begin = fmt;
+        const char* p = fmt;
+        while (*p) {
+            if ((p[0] == '{' || p[0] == '}') && p[1] == p[0]) {   // {{ 或 }}，输出一个
+                ss.append(begin, p - begin + 1);
+                p += 2;
+                begin = p;
+            } else if (p[0] == '{' && p[1] == '}') {
+                ss.append(begin, p - begin);
+                fmt = p + 2;
+                return true;
+            } else {
+                ++p;
+            }
         }
-    };
+        ss.append(begin, p - begin);
+        fmt = p;
+        return false;
+    }
 
-    // 行号
-    class LineFormatItem : public LogFormatter::FormatItem {
-    public:
-        LineFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << event->getLine();
-        }
-    };
+    // 数字先写进栈上的缓冲区(见numfmt.h)，再一次追加
+    static inline void AppendUInt(std::string& out, uint64_t val) {
+        char buf[24];
+        out.append(buf, FormatUInt(buf, val) - buf);
+    }
 
-    // 换行符
-    class NewLineFormatItem : public LogFormatter::FormatItem {
-    public:
-        NewLineFormatItem(const std::string& str = ""){}
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << std::endl;
-        }
-    };
+    static inline void AppendInt(std::string& out, int64_t val) {
+        char buf[24];
+        out.append(buf, FormatInt(buf, val) - buf);
+    }
 
-    //string 格式
-    class StringFormatItem : public LogFormatter::FormatItem {
-    public:
-        StringFormatItem(const std::string& str)
-            : FormatItem(str), m_string(str){
+    static inline void AppendDouble(std::string& out, double val, bool json) {
+        if (json && !std::isfinite(val)) {
+            out.append("null");   // JSON没有NaN和Inf
+            return;
         }
-        void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-            os << m_string;
+        char buf[32];
+        out.append(buf, FormatDouble(buf, val) - buf);
+    }
+
+    static inline void AppendString(std::string& out, std::string_view str, bool json) {
+        if (json) {
+            AppendJsonEscaped(out, str);
+        } else {
+            out.append(str);
         }
+    }
 
-    private:
-        std::string m_string;
-    };
+    // 结构化字段，json时每个字段输出为 ,"key":value ，否则为 key=value 以空格分隔
+    static void AppendFields(std::string& out, const LogFields& fields, bool json) {
+        bool first = true;
+        fields.forEach([&out, &first, json](const LogFields::Field& f) {
+            if (json) {
+                out.append(",\"", 2);
+                AppendJsonEscaped(out, f.key);
+                out.append("\":", 2);
+            } else {
+                if (!first) {
+                    out.push_back(' ');
+                }
+                out.append(f.key);
+                out.push_back('=');
+            }
+            first = false;
+            switch (f.type) {
+                case LogFields::INT:
+                    AppendInt(out, f.i);
+                    break;
+                case LogFields::UINT:
+                    AppendUInt(out, f.u);
+                    break;
+                case LogFields::DOUBLE:
+                    AppendDouble(out, f.d, json);
+                    break;
+                case LogFields::BOOL:
+                    out.append(f.b ? "true" : "false");
+                    break;
+                case LogFields::STRING:
+                    if (json || f.str.empty() || f.str.find_first_of(" \"=") != std::string_view::npos) {
+                        out.push_back('"');
+                        AppendJsonEscaped(out, f.str);
+                        out.push_back('"');
+                    } else {
+                        out.append(f.str);
+                    }
+                    break;
+            }
+        });
+    }
 
     Logger::Logger(const std::string &name)
-            : m_name(name)
-            , m_level(LogLevel::DEBUG) () {
+            : m_level(LogLevel::DEBUG)
+            , m_name(name)
+            , m_appenders(new AppenderTable) {
         // 初始化个formatter， 比如有时候appender不需要formatter，直接使用logformatter
         m_formatter.reset(new LogFormatter("%d [%p] %f %l %m %n"));
     }
 
+    Logger::~Logger() {
+        stopAsync();
+        delete m_appenders.load(std::memory_order_acquire);
+        delete m_spill.load(std::memory_order_acquire);
+    }
+
+    std::atomic<uint32_t> LogAppender::s_levelVersion{0};
+
+    void Logger::publishAppenders(AppenderList list) {
+        AppenderTable* table = new AppenderTable;
+        // 先取版本再读级别，建表期间有setLevel的话版本对不上，下次dispatch会再建一次
+        table->levelVersion = LogAppender::GetLevelVersion();
+        table->all = std::move(list);
+        for (auto& i : table->all) {
+            for (int level = LogLevel::DEBUG; level <= LogLevel::FATAL; ++level) {
+                if (level >= i->getLevel()) {
+                    table->byLevel[level].push_back(i.get());
+                }
+            }
+        }
+        HazardRetire(m_appenders.exchange(table));
+    }
+
+    void Logger::rebuildAppenders() {
+        Mutex::Lock lock(m_appenderMutex);
+        const AppenderTable* old = m_appenders.load(std::memory_order_relaxed);
+        if (old->levelVersion != LogAppender::GetLevelVersion()) {
+            publishAppenders(old->all);
+        }
+    }
+
     void Logger::addAppender(LogAppender::ptr appender) {
-        if(!appender->getFormatter){  // 如果没有formatter，那么设置为默认
+        if(!appender->getFormatter()){  // 如果没有formatter，那么设置为默认
+            RWMutex::ReadLock lock(m_configMutex);
             appender->setFormatter(m_formatter);
         }
-        m_appenders.push_back(appender);
+        Mutex::Lock lock(m_appenderMutex);
+        AppenderList list = m_appenders.load(std::memory_order_relaxed)->all;
+        list.push_back(appender);
+        publishAppenders(std::move(list));
     }
 
     void Logger::delAppender(LogAppender::ptr appender) {
+        Mutex::Lock lock(m_appenderMutex);
+        const AppenderList& old = m_appenders.load(std::memory_order_relaxed)->all;
         //  遍历的方式删除
-        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
+        for (auto it = old.begin(); it != old.end(); ++it) {
             if (*it == appender) {
-                m_appenders.erase(it);
+                AppenderList list(old.begin(), it);
+                list.insert(list.end(), it + 1, old.end());
+                publishAppenders(std::move(list));
                 break;
             }
         }
     }
 
+    void Logger::setAppenders(const std::vector<LogAppender::ptr>& appenders) {
+        RWMutex::ReadLock config_lock(m_configMutex);
+        for (auto& i : appenders) {
+            if (!i->getFormatter()) {
+                i->setFormatter(m_formatter);
+            }
+        }
+        config_lock.unlock();
+        Mutex::Lock lock(m_appenderMutex);
+        publishAppenders(appenders);
+    }
+
+    std::vector<LogAppender::ptr> Logger::getAppenders() {
+        Mutex::Lock lock(m_appenderMutex);
+        return m_appenders.load(std::memory_order_relaxed)->all;
+    }
+
+    void Logger::setFormatter(LogFormatter::ptr val) {
+        RWMutex::WriteLock lock(m_configMutex);
+        m_formatter = val;
+    }
+
+    LogFormatter::ptr Logger::getFormatter() {
+        RWMutex::ReadLock lock(m_configMutex);
+        return m_formatter;
+    }
+
     void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
         if (level >= m_level) {  //日志器的记录级别大于当前的事件级别，才会记录
-            auto self = shared_from_this(); //返回一个当前类的std::shared_ptr
-            for (auto &i: m_appenders) {
-                i->log(self, level, event);  // param (logger, level, event)
+            auto* queue = m_queue.load(std::memory_order_acquire);
+            if (queue) {
+                // 异步模式，生产者只做一次CAS入队
+                QueuedEvent e;
+                e.level = level;
+                e.event = std::move(event);
+                if (WEBSERVER_UNLIKELY(!queue->tryPush(e))) {
+                    pushOverflow(e);
+                }
+                return;
+            }
+            dispatch(level, *event);
+        }
+    }
+
+    // 一次dispatch最多缓存几个不同formatter的结果，超出的appender自己格式化
+    static const size_t MAX_SHARED_FORMATTERS = 8;
+    // appender里又打日志时dispatch会嵌套，每一层用自己的一组缓冲区，更深的不共享格式化结果
+    static const int MAX_DISPATCH_DEPTH = 4;
+    static thread_local int s_dispatch_depth = 0;
+
+    void Logger::dispatch(LogLevel::Level level, const LogEvent& event) {
+        // 按formatter分组：每个formatter只格式化一次，同组的appender拿到同一块文本
+        static thread_local std::string s_texts[MAX_DISPATCH_DEPTH][MAX_SHARED_FORMATTERS];
+        struct DepthGuard {
+            int depth = s_dispatch_depth++;
+            ~DepthGuard() { --s_dispatch_depth; }
+        } guard;
+        LogFormatter* formatters[MAX_SHARED_FORMATTERS];
+        size_t count = 0;
+        HazardPointer hp;
+        const AppenderTable* table = hp.protect(m_appenders);
+        if (WEBSERVER_UNLIKELY(table->levelVersion != LogAppender::GetLevelVersion())) {
+            // 级别刚被修改，重建后这一条就按新表输出(重新保护，旧表可以释放)
+            rebuildAppenders();
+            table = hp.protect(m_appenders);
+        }
+        if (WEBSERVER_UNLIKELY(guard.depth >= MAX_DISPATCH_DEPTH)) {
+            for (LogAppender* i : table->byLevel[level]) {
+                i->log(*this, level, event);
+            }
+            return;
+        }
+        std::string* texts = s_texts[guard.depth];
+        for (LogAppender* i : table->byLevel[level]) {
+            LogFormatter* formatter = i->getFormatter().get();
+            size_t idx = 0;
+            while (idx < count && formatters[idx] != formatter) {
+                ++idx;
+            }
+            if (idx == count) {
+                if (!formatter || count == MAX_SHARED_FORMATTERS) {
+                    i->log(*this, level, event);  // param (logger, level, event)
+                    continue;
+                }
+                formatters[count] = formatter;
+                texts[count].clear();
+                formatter->format(texts[count], *this, level, event);
+                ++count;
+            }
+            i->logFormatted(*this, level, event, texts[idx].data(), texts[idx].size());
+        }
+    }
+
+    void Logger::startAsync(size_t capacity) {
+        if (m_queue.load(std::memory_order_acquire)) {
+            return;
+        }
+        auto* queue = new MpscRingBuffer<QueuedEvent>(capacity);
+        m_consumed.store(0, std::memory_order_relaxed);
+        m_asyncRunning.store(true, std::memory_order_release);
+        // 在发布队列之前记下计数，同步阶段的丢弃不算；之后的都会汇报
+        uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+        uint64_t spilled = m_spilled.load(std::memory_order_relaxed);
+        m_queue.store(queue, std::memory_order_release);
+        m_consumer = std::thread(&Logger::consume, this, dropped, spilled);
+    }
+
+    void Logger::setOverflowPolicy(OverflowPolicy policy, LogLevel::Level keep_level) {
+        m_overflowKeepLevel.store(keep_level, std::memory_order_relaxed);
+        m_overflowPolicy.store(policy, std::memory_order_relaxed);
+    }
+
+    bool Logger::setSpillFile(const std::string& filename) {
+        FileLogAppender::ptr appender(new FileLogAppender(filename));
+        if (!appender->reopen()) {
+            return false;
+        }
+        appender->setFormatter(getFormatter());
+        setSpillAppender(appender);
+        return true;
+    }
+
+    void Logger::setSpillAppender(FileLogAppender::ptr appender) {
+        SpillTarget* target = nullptr;
+        if (appender) {
+            target = new SpillTarget;
+            target->appender = std::move(appender);
+        }
+        const SpillTarget* old = m_spill.exchange(target, std::memory_order_acq_rel);
+        if (old) {
+            old->appender->flush();
+        }
+        // 可能还有生产者在往旧文件写，等它们离开后再释放
+        HazardRetire(old);
+    }
+
+    std::string Logger::getSpillFile() {
+        HazardPointer hp;
+        const SpillTarget* target = hp.protect(m_spill);
+        return target ? target->appender->getFilename() : std::string();
+    }
+
+    void Logger::pushOverflow(QueuedEvent& e) {
+        switch (m_overflowPolicy.load(std::memory_order_relaxed)) {
+            case OVERFLOW_DROP_NEWEST:
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            case OVERFLOW_DROP_BELOW_LEVEL:
+                if (e.level < m_overflowKeepLevel.load(std::memory_order_relaxed)) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                break;
+            case OVERFLOW_SPILL:
+            {
+                HazardPointer hp;
+                const SpillTarget* target = hp.protect(m_spill);
+                if (target) {
+                    target->appender->log(*this, e.level, *e.event);
+                    m_spilled.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        auto* queue = m_queue.load(std::memory_order_acquire);
+        while (!queue->tryPush(e)) {
+            std::this_thread::yield();   // 等消费者腾出位置
+        }
+    }
+
+    void Logger::reportOverflow(uint64_t& dropped, uint64_t& spilled) {
+        uint64_t d = m_dropped.load(std::memory_order_relaxed);
+        uint64_t s = m_spilled.load(std::memory_order_relaxed);
+        if (d == dropped && s == spilled) {
+            return;
+        }
+        uint64_t sec = 0;
+        uint32_t nsec = 0;
+        GetCurrentTime(sec, nsec);
+        LogEvent::ptr event = LogEvent::Create(__FILE__, __LINE__, GetElapsedMS(), GetThreadId(), 0, sec, nsec);
+        event->setThreadName(GetThreadName());
+        event->getSS() << "async log queue full: dropped " << d - dropped << ", spilled " << s - spilled;
+        event->addField("dropped", d - dropped);
+        event->addField("spilled", s - spilled);
+        // 直接交给appender，经过队列的话队列满时消费者会等自己
+        dispatch(LogLevel::WARN, *event);
+        dropped = d;
+        spilled = s;
+    }
+
+    void Logger::stopAsync() {
+        auto* queue = m_queue.load(std::memory_order_acquire);
+        if (!queue) {
+            return;
+        }
+        m_asyncRunning.store(false, std::memory_order_release);
+        m_consumer.join();
+        m_queue.store(nullptr, std::memory_order_release);
+        delete queue;
+    }
+
+    void Logger::flush() {
+        auto* queue = m_queue.load(std::memory_order_acquire);
+        if (queue) {
+            size_t target = queue->enqueueCount();
+            while (m_consumed.load(std::memory_order_acquire) < target) {
+                std::this_thread::yield();
+            }
+        }
+        HazardPointer hp;
+        for (auto &i: hp.protect(m_appenders)->all) {
+            i->flush();
+        }
+        const SpillTarget* spill = hp.protect(m_spill);
+        if (spill) {
+            spill->appender->flush();
+        }
+    }
+
+    // 把一段文本追加到定长缓冲区，放不下的部分截断
+    static size_t AppendTo(char* buf, size_t pos, size_t cap, const char* data, size_t len) {
+        if (pos + len > cap) {
+            len = cap - pos;
+        }
+        memcpy(buf + pos, data, len);
+        return pos + len;
+    }
+
+    void Logger::emergencyFlush() {
+        // 不能用HazardPointer(可能分配内存)，直接读当前快照；崩溃时不会再修改appender
+        const AppenderTable* appenders = m_appenders.load(std::memory_order_acquire);
+        for (auto& i : appenders->all) {
+            i->emergencyFlush();
+        }
+        const SpillTarget* spill = m_spill.load(std::memory_order_acquire);
+        if (spill) {
+            spill->appender->emergencyFlush();
+        }
+        auto* queue = m_queue.load(std::memory_order_acquire);
+        if (!queue) {
+            return;
+        }
+        // 队列里的事件还没格式化，formatter会分配内存，只输出简化的一行
+        queue->peek([this](const QueuedEvent& e) {
+            if (!e.event) {
+                return;
+            }
+            char buf[4096];
+            size_t cap = sizeof(buf) - 1;   // 留一个字节给'\n'
+            size_t pos = AppendTo(buf, 0, cap, "[", 1);
+            const char* level = LogLevel::ToString(e.level);
+            pos = AppendTo(buf, pos, cap, level, strlen(level));
+            pos = AppendTo(buf, pos, cap, "] ", 2);
+            const char* file = e.event->getFile();
+            if (file) {
+                pos = AppendTo(buf, pos, cap, file, strlen(file));
+            }
+            char num[16];
+            num[0] = ':';
+            pos = AppendTo(buf, pos, cap, num, FormatInt(num + 1, e.event->getLine()) - num);
+            pos = AppendTo(buf, pos, cap, " ", 1);
+            std::string_view content = e.event->getContentView();
+            pos = AppendTo(buf, pos, cap, content.data(), content.size());
+            buf[pos++] = '\n';
+            emergencyWrite(buf, pos);
+        });
+    }
+
+    void Logger::emergencyWrite(const char* data, size_t len) {
+        const AppenderTable* appenders = m_appenders.load(std::memory_order_acquire);
+        for (auto& i : appenders->all) {
+            i->emergencyWrite(data, len);
+        }
+    }
+
+    void Logger::consume(uint64_t dropped, uint64_t spilled) {
+        SetThreadName("log_consumer");
+        int crash_slot = CrashHandler::RegisterWorker();
+        QueuedEvent e;
+        int idle = 0;
+        auto* queue = m_queue.load(std::memory_order_acquire);
+        uint64_t popped = 0;
+        auto next_report = std::chrono::steady_clock::now();
+        while (true) {
+            // 崩溃处理开始后停在这里，不再出队
+            CrashHandler::CheckCrashing(crash_slot);
+            // 每处理1024条或空闲时看一次时间，不是每条都读时钟
+            if ((popped & 1023) == 0 || idle) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= next_report) {
+                    reportOverflow(dropped, spilled);
+                    next_report = now + std::chrono::milliseconds(m_overflowReportMs.load(std::memory_order_relaxed));
+                }
+            }
+            // 先读标志再出队，停止前提交的日志一定能被取到
+            bool running = m_asyncRunning.load(std::memory_order_acquire);
+            if (queue->tryPop(e)) {
+                dispatch(e.level, *e.event);
+                e.event.reset();
+                m_consumed.fetch_add(1, std::memory_order_release);
+                ++popped;
+                idle = 0;
+                continue;
+            }
+            if (!running) {
+                reportOverflow(dropped, spilled);
+                CrashHandler::UnregisterWorker(crash_slot);
+                break;   // 已停止且队列已空
+            }
+            // 生产者不加锁也就没法notify，空闲时逐步退避
+            if (idle < 1024) {
+                ++idle;
+            }
+            if (idle < 64) {
+                std::this_thread::yield();
+            } else {
+                CrashHandler::WorkerIdle(crash_slot);
+                std::this_thread::sleep_for(std::chrono::microseconds(idle < 1024 ? 50 : 500));
+                CrashHandler::WorkerBusy(crash_slot);
             }
         }
     }
 
     void Logger::debug(LogEvent::ptr event) {
-        log(LogLevel::DEBUG, event);
+        log(LogLevel::DEBUG, std::move(event));
     }
 
     void Logger::info(LogEvent::ptr event) {
-        log(LogLevel::INFO, event);
+        log(LogLevel::INFO, std::move(event));
     }
 
     void Logger::warn(LogEvent::ptr event) {
-        log(LogLevel::WARN, event);
+        log(LogLevel::WARN, std::move(event));
     }
 
     void Logger::error(LogEvent::ptr event) {
-        log(LogLevel::ERROR, event);
+        log(LogLevel::ERROR, std::move(event));
     }
 
     void Logger::fatal(LogEvent::ptr event) {
-        log(LogLevel::FATAL, event);
+        log(LogLevel::FATAL, std::move(event));
+    }
+
+    LogEventWrap::LogEventWrap(Logger* logger, LogLevel::Level level, const char* file, int32_t line)
+            : m_logger(logger)
+            , m_level(level) {
+        uint64_t sec = 0;
+        uint32_t nsec = 0;
+        GetCurrentTime(sec, nsec);
+        m_event = LogEvent::Create(file, line, GetElapsedMS(), GetThreadId(), 0, sec, nsec);
+        m_event->setThreadName(GetThreadName());
+    }
+
+    LogEventWrap::~LogEventWrap() {
+        m_logger->log(m_level, std::move(m_event));
     }
 
     // 输出到文件的日志
     FileLogAppender::FileLogAppender(const std::string &filename)
-            : m_filename(filename) {   // 初始化日志事件的name
+            : m_filename(filename)    // 初始化日志事件的name
+            , m_buf(new char[BUFFER_SIZE]) {
+        reopen();
+    }
+
+    FileLogAppender::~FileLogAppender() {
+        flushBuffer();
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    void FileLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        static thread_local std::string buf;   // 每个线程复用一块缓冲区
+        buf.clear();
+        m_formatter->format(buf, logger, level, event); // 存为一个string，后续交给appender
+        write(buf.data(), buf.size());
     }
 
-    void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-        if (level >= m_level) {
-            m_filestream << m_formatter->format(logger, level, event); // 存为一个string，后续交给appender
+    void FileLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                       const char* data, size_t len) {
+        write(data, len);
+    }
+
+
+    bool FileLogAppender::reopen() {
+        PolicyMutex::Lock lock(m_mutex);
+        return doReopen();
+    }
+
+    bool FileLogAppender::doReopen() {
+        flushBuffer();
+        if (m_fd >= 0) { //如果打开
+            ::close(m_fd);
         }
+        // 追加写，重启后不会覆盖还没切分的日志
+        m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st;
+        m_fileSize = (m_fd >= 0 && fstat(m_fd, &st) == 0) ? (uint64_t)st.st_size : 0;
+        m_openTime = time(nullptr);
+        updateNextRotateTime();
+        return m_fd >= 0;
     }
 
+    // 写满或写不下为止，被信号打断时重试
+    static void WriteAll(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += n;
+            len -= n;
+        }
+    }
 
-    bool FileLogAppender::reopen() { //private已经给了个fstream,直接判断即可
-        if (m_filestream) { //如果打开
-            m_filestream.close();
+    void FileLogAppender::flushBuffer() {
+        if (m_bufLen && m_fd >= 0) {
+            WriteAll(m_fd, m_buf.get(), m_bufLen);
         }
-        m_filestream.open(m_filename);
+        m_bufLen = 0;
     }
 
-    // 输出到控制台的appender
-    void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-        if(level >= m_level){
-            std::cout<< m_formatter->format(logger, level, event);
+    void FileLogAppender::write(const char* data, size_t len) {
+        PolicyMutex::Lock lock(m_mutex);
+        if (m_rotate.interval != ROTATE_NONE && time(nullptr) >= m_nextRotateTime) {
+            doRotate();
         }
+        if (m_bufLen + len > BUFFER_SIZE) {
+            flushBuffer();
+        }
+        if (len >= BUFFER_SIZE) {
+            WriteAll(m_fd, data, len);   // 超过缓冲区的大块直接写
+        } else {
+            memcpy(m_buf.get() + m_bufLen, data, len);
+            m_bufLen += len;
+        }
+        m_fileSize += len;
+        if (m_rotate.max_size && m_fileSize >= m_rotate.max_size) {
+            doRotate();
+        }
+    }
+
+    void FileLogAppender::setRotatePolicy(const RotatePolicy& policy) {
+        PolicyMutex::Lock lock(m_mutex);
+        m_rotate = policy;
+        updateNextRotateTime();
+    }
+
+    bool FileLogAppender::rotate() {
+        PolicyMutex::Lock lock(m_mutex);
+        return doRotate();
+    }
+
+    bool FileLogAppender::doRotate() {
+        if (m_fileSize == 0) {   // 空文件不切分，只推进下一次切分的时刻
+            m_openTime = time(nullptr);
+            updateNextRotateTime();
+            return true;
+        }
+        // 改名是原子的，改名后立即重新打开，写日志的线程不会等待压缩和清理
+        flushBuffer();
+        std::string target = LogRotator::MakeRotatedName(m_filename, m_openTime, m_rotateStamp, m_rotateSeq);
+        bool ok = ::rename(m_filename.c_str(), target.c_str()) == 0;
+        if (!ok) {
+            std::cout << "rotate " << m_filename << " to " << target << " failed: " << strerror(errno) << std::endl;
+        }
+        doReopen();
+        if (ok) {
+            LogRotator::GetInstance()->schedule(m_filename, m_rotate);
+        } else {
+            // 没改成名的文件大小仍超过max_size，不清零的话之后每条日志都会再试一次；
+            // 再写max_size字节后重试，按时间切分的已由doReopen推到下一个时刻
+            m_fileSize = 0;
+            --m_rotateSeq;   // 序号没用上，下次还用它
+        }
+        return ok;
+    }
+
+    void FileLogAppender::updateNextRotateTime() {
+        if (m_rotate.interval == ROTATE_NONE) {
+            m_nextRotateTime = 0;
+            return;
+        }
+        struct tm tm;
+        localtime_r(&m_openTime, &tm);
+        tm.tm_min = 0;
+        tm.tm_sec = 0;
+        if (m_rotate.interval == ROTATE_HOURLY) {
+            tm.tm_hour += 1;
+        } else {
+            tm.tm_hour = 0;
+            tm.tm_mday += 1;
+        }
+        tm.tm_isdst = -1;   // 由mktime处理夏令时
+        m_nextRotateTime = mktime(&tm);
+    }
+
+    void FileLogAppender::flush() {
+        PolicyMutex::Lock lock(m_mutex);
+        flushBuffer();
+    }
+
+    void FileLogAppender::emergencyFlush() {
+        // 不加锁：被打断的线程可能正持有m_mutex
+        size_t len = m_bufLen;
+        if (len > BUFFER_SIZE) {
+            len = BUFFER_SIZE;
+        }
+        if (len && m_fd >= 0) {
+            WriteAll(m_fd, m_buf.get(), len);
+        }
+        m_bufLen = 0;
+    }
+
+    void FileLogAppender::emergencyWrite(const char* data, size_t len) {
+        emergencyFlush();
+        if (m_fd >= 0) {
+            WriteAll(m_fd, data, len);
+        }
+    }
+
+    // 输出到控制台的appender
+    void StdoutLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+        write(buf.data(), buf.size());
+    }
+
+    void StdoutLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                         const char* data, size_t len) {
+        write(data, len);
+    }
+
+    void StdoutLogAppender::write(const char* data, size_t len) {
+        PolicyMutex::Lock lock(m_mutex);
+        std::cout.write(data, len);
+    }
+
+    void StdoutLogAppender::flush() {
+        PolicyMutex::Lock lock(m_mutex);
+        std::cout.flush();
+    }
+
+    void StdoutLogAppender::emergencyWrite(const char* data, size_t len) {
+        WriteAll(STDOUT_FILENO, data, len);   // 绕过std::cout的缓冲区和锁
     }
 
 
     LogFormatter::LogFormatter(const std::string &pattern)
             : m_pattern(pattern) {
+        inits();
+    }
+
+    /*
+     * 时间的线程缓存
+     * 同一秒内的日志，秒及以上的部分完全一样，只在跨秒时重新 localtime_r + strftime，
+     * 秒以下的数字在缓存的结果上直接改写
+     * localtime_r 和 localtime 一样要拿glibc的时区锁(区别只是不用静态的结果缓冲区)，
+     * 省下的是每秒只调用一次，同一秒内的日志不碰这把锁
+     * */
+    struct DateTimeCache {
+        uint32_t id = 0;       // 对应哪条OP_DATETIME指令
+        int64_t sec = -1;      // 缓存的是哪一秒
+        uint32_t len = 0;
+        uint32_t fracPos = 0;  // 秒以下的数字在buf中的位置
+        char buf[128];
+    };
+    static const size_t DATETIME_CACHE_SIZE = 4;   // 一个线程同时使用的时间格式一般不多
+    static thread_local DateTimeCache s_datetime_cache[DATETIME_CACHE_SIZE];
+    static std::atomic<uint32_t> s_datetime_id{0};
+
+    /*
+     * 按op的格式把sec写进buf，秒以下的数字只留出位置(frac_pos)
+     * 放不下时返回false(strftime放不下时返回0，不能当作长度用)
+     * */
+    static bool FormatDateTime(char* buf, size_t size, const LogFormatter::Op& op, const char* literals,
+                               uint64_t sec, uint32_t& len, uint32_t& frac_pos) {
+        // 秒以下的部分把格式切成前后两段，分别strftime，中间留出数字的位置
+        struct tm tm;
+        time_t t = sec;
+        localtime_r(&t, &tm);
+        const char* pre = literals + op.offset;
+        size_t n = strftime(buf, size, pre, &tm);
+        if (n == 0 && *pre) {
+            return false;
+        }
+        frac_pos = n;
+        if (op.digits) {
+            n += op.digits;
+            if (n > size) {
+                return false;
+            }
+            const char* post = pre + op.len + 1;
+            if (*post) {
+                size_t m = strftime(buf + n, size - n, post, &tm);
+                if (m == 0) {
+                    return false;
+                }
+                n += m;
+            }
+        }
+        len = n;
+        return true;
+    }
+
+    // 在p处写digits位的秒以下数字
+    static void WriteFraction(char* p, int digits, uint32_t nsec) {
+        for (int i = digits; i < 9; ++i) {
+            nsec /= 10;
+        }
+        for (int i = digits - 1; i >= 0; --i) {
+            p[i] = '0' + nsec % 10;
+            nsec /= 10;
+        }
     }
 
-    std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-        // 遍历获取pattern
-        std::stringstream ss;
-        for (auto &a: m_items) {
-            a->format(logger, ss, level, event);
+    static void AppendDateTime(std::string& out, const LogFormatter::Op& op, const char* literals,
+                               uint64_t sec, uint32_t nsec) {
+        DateTimeCache& cache = s_datetime_cache[op.id % DATETIME_CACHE_SIZE];
+        if (cache.id != op.id || cache.sec != (int64_t)sec) {
+            if (!FormatDateTime(cache.buf, sizeof(cache.buf), op, literals, sec, cache.len, cache.fracPos)) {
+                // 结果比缓存长，不缓存，每次在更大的临时缓冲区里格式化
+                cache.sec = -1;
+                char buf[1024];
+                uint32_t len = 0;
+                uint32_t frac_pos = 0;
+                if (FormatDateTime(buf, sizeof(buf), op, literals, sec, len, frac_pos)) {
+                    WriteFraction(buf + frac_pos, op.digits, nsec);
+                    out.append(buf, len);
+                }
+                return;
+            }
+            cache.id = op.id;
+            cache.sec = sec;
+        }
+        size_t base = out.size();
+        out.append(cache.buf, cache.len);
+        if (op.digits) {
+            WriteFraction(&out[base + cache.fracPos], op.digits, nsec);
         }
-        return ss.str(); // return content
     }
 
+    std::string LogFormatter::format(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        std::string str;
+        format(str, logger, level, event);
+        return str; // return content
+    }
+
+    void LogFormatter::format(std::string& out, const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        const char* literals = m_literals.data();
+        // 遍历指令，直接追加到out
+        for (const Op& op : m_program) {
+            switch (op.code) {
+                case OP_LITERAL:
+                    out.append(literals + op.offset, op.len);
+                    break;
+                case OP_MESSAGE:
+                    AppendString(out, event.getContentView(), op.json);
+                    break;
+                case OP_LEVEL:
+                    out.append(LogLevel::ToString(level));
+                    break;
+                case OP_ELAPSE:
+                    AppendUInt(out, event.getElapse());
+                    break;
+                case OP_NAME:
+                    AppendString(out, logger.getName(), op.json);
+                    break;
+                case OP_THREAD_ID:
+                    AppendUInt(out, event.getThreadId());
+                    break;
+                case OP_FIBER_ID:
+                    AppendUInt(out, event.getFiberId());
+                    break;
+                case OP_DATETIME:
+                    AppendDateTime(out, op, literals, event.getTime(), event.getNsec());
+                    break;
+                case OP_FILENAME:
+                    AppendString(out, event.getFile(), op.json);
+                    break;
+                case OP_LINE:
+                    AppendUInt(out, event.getLine());
+                    break;
+                case OP_NEWLINE:
+                    out.push_back('\n');
+                    break;
+                case OP_TAB:
+                    out.push_back('\t');
+                    break;
+                case OP_FIELDS:
+                    AppendFields(out, event.getFields(), op.json);
+                    break;
+                case OP_THREAD_NAME:
+                    AppendString(out, event.getThreadName(), op.json);
+                    break;
+            }
+        }
+    }
+
+    // 把一段文本放进m_literals，返回引用它的指令
+    static LogFormatter::Op MakeLiteralOp(std::string& literals, LogFormatter::OpCode code, const std::string& str) {
+        LogFormatter::Op op;
+        op.code = code;
+        op.offset = literals.size();
+        op.len = str.size();
+        literals.append(str);
+        literals.push_back('\0');   // 时间格式要交给strftime，需要'\0'结尾
+        return op;
+    }
+
+
+    /*
+     * 时间指令：m_literals中依次存放 秒以下数字之前的strftime格式 '\0' 之后的格式 '\0'
+     * offset/len 指向前一段
+     * */
+    static LogFormatter::Op MakeDateTimeOp(std::string& literals, const std::string& str) {
+        std::string fmt = str.empty() ? "%Y-%m-%d %H:%M:%S" : str;
+        std::string pre = fmt;
+        std::string post;
+        uint8_t digits = 0;
+        for (size_t i = 0; i + 1 < fmt.size(); ++i) {
+            if (fmt[i] != '%') {
+                continue;
+            }
+            if (fmt[i + 1] == '%') {   // strftime的%%
+                ++i;
+                continue;
+            }
+            size_t len = 0;
+            if (fmt[i + 1] == 'N') {
+                digits = 9;
+                len = 2;
+            } else if (i + 2 < fmt.size() && fmt[i + 2] == 'N'
+                       && (fmt[i + 1] == '3' || fmt[i + 1] == '6' || fmt[i + 1] == '9')) {
+                digits = fmt[i + 1] - '0';
+                len = 3;
+            }
+            if (digits) {
+                pre = fmt.substr(0, i);
+                post = fmt.substr(i + len);
+                break;
+            }
+        }
+        LogFormatter::Op op = MakeLiteralOp(literals, LogFormatter::OP_DATETIME, pre);
+        literals.append(post);
+        literals.push_back('\0');
+        op.digits = digits;
+        op.id = ++s_datetime_id;
+        return op;
+    }
+
+    /*
+     * %J 展开成一串普通指令：字面的键名和标点 + 各字段的指令(字符串按JSON转义)
+     * 执行时和文本格式走同一个循环，没有额外的分支
+     * */
+    static void MakeJsonOps(std::vector<LogFormatter::Op>& program, std::string& literals, const std::string& time_fmt) {
+        auto literal = [&](const char* str) {
+            program.push_back(MakeLiteralOp(literals, LogFormatter::OP_LITERAL, str));
+        };
+        auto item = [&](LogFormatter::OpCode code) {
+            LogFormatter::Op op;
+            op.code = code;
+            op.json = true;
+            program.push_back(op);
+        };
+        literal("{\"time\":\"");
+        program.push_back(MakeDateTimeOp(literals, time_fmt.empty() ? "%Y-%m-%dT%H:%M:%S.%6N%z" : time_fmt));
+        literal("\",\"level\":\"");
+        item(LogFormatter::OP_LEVEL);
+        literal("\",\"logger\":\"");
+        item(LogFormatter::OP_NAME);
+        literal("\",\"thread\":");
+        item(LogFormatter::OP_THREAD_ID);
+        literal(",\"thread_name\":\"");
+        item(LogFormatter::OP_THREAD_NAME);
+        literal("\",\"fiber\":");
+        item(LogFormatter::OP_FIBER_ID);
+        literal(",\"elapse\":");
+        item(LogFormatter::OP_ELAPSE);
+        literal(",\"file\":\"");
+        item(LogFormatter::OP_FILENAME);
+        literal("\",\"line\":");
+        item(LogFormatter::OP_LINE);
+        literal(",\"msg\":\"");
+        item(LogFormatter::OP_MESSAGE);
+        literal("\"");
+        item(LogFormatter::OP_FIELDS);
+        literal("}");
+    }
 
 // %xxx  %xxx{xxx} %%   类型  类型{格式}  需要输出%(即转义)   其余为正常文本格式
     void LogFormatter::inits() {
@@ -250,6 +1076,7 @@ namespace webserver {
             if ((i + 1) < m_pattern.size()) { // 判断是否转义
                 if (m_pattern[i + 1] == '%') {
                     nstr.append(1, '%');
+                    ++i;
                     continue;
                 }
             }
@@ -264,7 +1091,8 @@ namespace webserver {
             std::string fmt;
             // 根据默认格式来解析
             while (n < m_pattern.size()) {
-                if (isspace(m_pattern[n])) {  // 为空格
+                // 状态0下遇到非字母（空格、'['、':'等）说明%xxx结束
+                if (formatter_status == 0 && !isalpha(m_pattern[n]) && m_pattern[n] != '{') {
                     break;
                 }
 
@@ -286,12 +1114,7 @@ namespace webserver {
                         break;
                     }
                 }
-                /*++n;
-                if (n == m_pattern.size()) {
-                    if (str.empty()) { //str为空
-                        str = m_pattern.substr(i + 1);  // m_pattern为 %xxxxx 全是字符
-                    }
-                }*/
+                ++n;
             }
 
             // m_pattern 遍历完了，且未遇到括号{}，遇到'{' status=1，右括号'}'status=2
@@ -303,7 +1126,7 @@ namespace webserver {
                 //nstr为空
                 str = m_pattern.substr(i + 1, n - i - 1);
                 vec.emplace_back(std::make_tuple(str, fmt, 1));
-                i = n;
+                i = n - 1;
             } else if (formatter_status == 1) {
                 std::cout << "pattern_error: " << m_pattern << " - " << m_pattern.substr(i) << std::endl;
                 m_error = true;
@@ -314,59 +1137,73 @@ namespace webserver {
                     nstr.clear();
                 }
                 vec.emplace_back(std::make_tuple(str, fmt, 1));
-                i = n;
+                i = n - 1;
             }
         }
         if (!nstr.empty()) {
             vec.emplace_back(std::make_tuple(nstr, "", 0));
         }
 
-        // 给个映射关系,string -> function, function的返回值是 FormatItem::ptr 以对应不同class
+        // 给个映射关系,string -> 指令
         /*
          * %m -- 消息体
          * %p -- level
          * %r -- 启动后运行的时间
          * %c -- 日志器logger名称
          * %t -- 线程id
+         * %F -- 协程id
          * %n -- 回车换行
          * %d -- 时间
          * %f -- 文件名
          * %l -- 行号
+         * %T -- 制表符
+         * %N -- 线程名称
+         * %K -- 结构化字段
+         * %J -- 整条日志为一个JSON对象，不对应单条指令
          * */
-        static std::map <std::string, std::function<FormatItem::ptr(const std::string& fmt)>> s_format_items = {
-            #define XX(str,C) \
-                {#str, [](const std::string& fmt) {return FormatItem::ptr(new C(fmt));} }
-
-                XX(m, MessageFormatItem),
-                XX(p, LevelFormatItem),
-                XX(r, ElapseFormatItem),
-                XX(c, NameFormatItem),
-                XX(t, ThreadIdFormatItem),
-                //  XX(m, FiberIdFormatItem),
-                XX(n, NewLineFormatItem),
-                XX(d, DataTimeFormatItem),
-                XX(f, FileNameFormatItem),
-                XX(l, LineFormatItem),
+        static const OpCode OP_JSON = (OpCode)0xff;
+        static std::map<std::string, OpCode> s_format_items = {
+            #define XX(str, C) \
+                {#str, C}
+
+                XX(m, OP_MESSAGE),
+                XX(p, OP_LEVEL),
+                XX(r, OP_ELAPSE),
+                XX(c, OP_NAME),
+                XX(t, OP_THREAD_ID),
+                XX(F, OP_FIBER_ID),
+                XX(n, OP_NEWLINE),
+                XX(d, OP_DATETIME),
+                XX(f, OP_FILENAME),
+                XX(l, OP_LINE),
+                XX(T, OP_TAB),
+                XX(K, OP_FIELDS),
+                XX(N, OP_THREAD_NAME),
+                XX(J, OP_JSON),
+            #undef XX
         };
 
+        m_program.clear();
+        m_literals.clear();
         for(auto& i : vec){   // @param : str, 格式， 类别
             if(std::get<2>(i) == 0){   // normal string
-                m_items.emplace_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+                m_program.push_back(MakeLiteralOp(m_literals, OP_LITERAL, std::get<0>(i)));
             }else{   //%xxx   和 %%xxx 转义
-                auto it = std::get<1>(i);
+                auto it = std::get<0>(i);
                 auto fd = s_format_items.find(it);
-                if(fd != s_format_items.end()){  //找到对应格式
-                    m_items.emplace_back(FormatItem::ptr(fd->second(std::get<1>(i))));
-                    // fd->second 为 std::function<FormatItem::ptr(const std::string& fmt)>
-                    // 传个参数  std::get<1>(i)  以获得对应格式
-                }else{ //未知格式
-                    m_items.emplace_back(FormatItem::ptr(new StringFormatItem("<< error format %" + std::get<1>(i) + ">>")));
+                if(fd == s_format_items.end()){ //未知格式
+                    m_program.push_back(MakeLiteralOp(m_literals, OP_LITERAL, "<< error format %" + std::get<0>(i) + ">>"));
                     m_error = true;
+                }else if(fd->second == OP_DATETIME){  // 时间格式 {}内的内容
+                    m_program.push_back(MakeDateTimeOp(m_literals, std::get<1>(i)));
+                }else if(fd->second == OP_JSON){
+                    MakeJsonOps(m_program, m_literals, std::get<1>(i));
+                }else{
+                    Op op;
+                    op.code = fd->second;
+                    m_program.push_back(op);
                 }
             }
-
-            // debug
-            std::cout << std::get<0>(i) << " - " << std::get<1>(i) << " - " << std::get<2>(i) <<std::endl;
         }
 
     }
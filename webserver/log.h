@@ -1,9 +1,5 @@
 #ifndef __WEBSERVER_LOG_H__
-#define __WEBSERVER_LOG_H_
-
-class ptr;
-
-class ptr;
+#define __WEBSERVER_LOG_H__
 
 #include <iostream>
 #include <string>
@@ -14,11 +10,340 @@ class ptr;
 #include <sstream>
 #include <tuple>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include "ring_buffer.h"
+#include "pool.h"
+#include "macro.h"
+#include "mutex.h"
+#include "ratelimit.h"
+#include "numfmt.h"
+#include "util.h"
+
+/*
+ * 编译期的最低日志级别(对应LogLevel::Level的数值)
+ * 低于它的 WEBSERVER_LOG_XXX 宏整条被编译器去掉，不产生任何代码
+ * 由CMake设置，Release构建默认为3(WARN)
+ * */
+#ifndef WEBSERVER_LOG_MIN_LEVEL
+#define WEBSERVER_LOG_MIN_LEVEL 1
+#endif
+
+/*
+ * 使用流式方式写日志，例如 WEBSERVER_LOG_INFO(logger) << "user " << id;
+ * 可以先附加结构化字段 WEBSERVER_LOG_INFO(logger).with("uid", id).with("ms", 1.5) << "login";
+ * 先判断级别再构造LogEvent，级别不够时只有一次(很好预测的)比较跳转
+ * 级别满足后再经过调用点限流(见ratelimit.h)，被丢弃的日志同样不构造事件
+ * 写成 if(!x){} else ... 的形式，宏用在if/else里也不会改变else的归属
+ * */
+#define WEBSERVER_LOG_LEVEL(logger, level) \
+    if (!((level) >= WEBSERVER_LOG_MIN_LEVEL && WEBSERVER_UNLIKELY((level) >= (logger)->getLevel()) \
+            && WEBSERVER_LOG_SITE_ALLOW())) {} \
+    else webserver::LogEventWrap(&*(logger), level, __FILE__, __LINE__)
+
+#define WEBSERVER_LOG_DEBUG(logger) WEBSERVER_LOG_LEVEL(logger, webserver::LogLevel::DEBUG)
+#define WEBSERVER_LOG_INFO(logger) WEBSERVER_LOG_LEVEL(logger, webserver::LogLevel::INFO)
+#define WEBSERVER_LOG_WARN(logger) WEBSERVER_LOG_LEVEL(logger, webserver::LogLevel::WARN)
+#define WEBSERVER_LOG_ERROR(logger) WEBSERVER_LOG_LEVEL(logger, webserver::LogLevel::ERROR)
+#define WEBSERVER_LOG_FATAL(logger) WEBSERVER_LOG_LEVEL(logger, webserver::LogLevel::FATAL)
+
+/*
+ * 格式化方式写日志，例如 WEBSERVER_LOG_FMT_INFO(logger, "user {} took {} ms", id, ms);
+ * fmt 必须是字符串字面量，占位符个数在编译期检查，级别不够时参数不会被求值
+ * */
+#define WEBSERVER_LOG_FMT_LEVEL(logger, level, fmt, ...) \
+    if (!((level) >= WEBSERVER_LOG_MIN_LEVEL && WEBSERVER_UNLIKELY((level) >= (logger)->getLevel()) \
+            && WEBSERVER_LOG_SITE_ALLOW())) {} \
+    else webserver::LogEventWrap(&*(logger), level, __FILE__, __LINE__) \
+            .format<webserver::CountFormatArgs(fmt)>(fmt, ##__VA_ARGS__)
+
+#define WEBSERVER_LOG_FMT_DEBUG(logger, fmt, ...) WEBSERVER_LOG_FMT_LEVEL(logger, webserver::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define WEBSERVER_LOG_FMT_INFO(logger, fmt, ...) WEBSERVER_LOG_FMT_LEVEL(logger, webserver::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define WEBSERVER_LOG_FMT_WARN(logger, fmt, ...) WEBSERVER_LOG_FMT_LEVEL(logger, webserver::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define WEBSERVER_LOG_FMT_ERROR(logger, fmt, ...) WEBSERVER_LOG_FMT_LEVEL(logger, webserver::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define WEBSERVER_LOG_FMT_FATAL(logger, fmt, ...) WEBSERVER_LOG_FMT_LEVEL(logger, webserver::LogLevel::FATAL, fmt, ##__VA_ARGS__)
 
 
 namespace webserver {
     class Logger;  // Logger 定义在之后，再写个class方便传参
+    class FileLogAppender;
+
+// 日志消息流
+    /*
+     * 代替 std::stringstream，消息直接写进内联的定长缓冲区
+     * 不构造iostream、不绑定locale，短消息不分配内存；超过内联容量才转到堆上
+     * */
+    class LogStream {
+    public:
+        static const size_t INLINE_SIZE = 256;   // 绝大多数日志消息放得下
+
+        LogStream() {}
+        ~LogStream() {
+            if (m_data != m_inline) {
+                delete[] m_data;
+            }
+        }
+        LogStream(const LogStream&) = delete;
+        LogStream& operator=(const LogStream&) = delete;
+
+        void append(const char* data, size_t len) {
+            if (m_size + len > m_cap) {
+                grow(m_size + len);
+            }
+            memcpy(m_data + m_size, data, len);
+            m_size += len;
+        }
+
+        LogStream& operator<<(const char* str) {
+            if (str) {
+                append(str, strlen(str));
+            } else {
+                append("(null)", 6);
+            }
+            return *this;
+        }
+        LogStream& operator<<(char* str) { return operator<<((const char*)str); }
+        LogStream& operator<<(const std::string& str) { append(str.data(), str.size()); return *this; }
+        LogStream& operator<<(std::string_view str) { append(str.data(), str.size()); return *this; }
+        LogStream& operator<<(char c) { append(&c, 1); return *this; }
+        LogStream& operator<<(bool v) { return v ? (append("true", 4), *this) : (append("false", 5), *this); }
+        LogStream& operator<<(short v) { return appendInteger(v); }
+        LogStream& operator<<(unsigned short v) { return appendInteger(v); }
+        LogStream& operator<<(int v) { return appendInteger(v); }
+        LogStream& operator<<(unsigned int v) { return appendInteger(v); }
+        LogStream& operator<<(long v) { return appendInteger(v); }
+        LogStream& operator<<(unsigned long v) { return appendInteger(v); }
+        LogStream& operator<<(long long v) { return appendInteger(v); }
+        LogStream& operator<<(unsigned long long v) { return appendInteger(v); }
+        LogStream& operator<<(float v) { return appendDouble(v); }
+        LogStream& operator<<(double v) { return appendDouble(v); }
+        LogStream& operator<<(const void* p);
+
+        // 其他只支持ostream输出的类型，借助ostringstream转换(会分配内存)
+        template<class T>
+        typename std::enable_if<!std::is_arithmetic<T>::value, LogStream&>::type
+        operator<<(const T& val) {
+            std::ostringstream ss;
+            ss << val;
+            const std::string& str = ss.str();
+            append(str.data(), str.size());
+            return *this;
+        }
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        std::string_view view() const { return std::string_view(m_data, m_size); }
+        std::string str() const { return std::string(m_data, m_size); }
+
+    private:
+        template<class T>
+        LogStream& appendInteger(T v) {
+            if (m_size + 24 > m_cap) {
+                grow(m_size + 24);
+            }
+            m_size = FormatNumber(m_data + m_size, v) - m_data;
+            return *this;
+        }
+        LogStream& appendDouble(double v);
+        void grow(size_t need);
+
+    private:
+        char* m_data = m_inline;
+        size_t m_size = 0;
+        size_t m_cap = INLINE_SIZE;
+        char m_inline[INLINE_SIZE];
+    };
+
+// 结构化字段
+    /*
+     * 事件附带的 键-值 对，值保持原来的类型，不先转成字符串
+     * 依次编码进内联缓冲区：[类型 1字节][键长 1字节][键][值]
+     *   整数/浮点数 8字节，bool 1字节，字符串 4字节长度+内容
+     * 字段不多时不分配内存，超过内联容量转到堆上
+     * 由 %J(一行JSON) 和 %K(key=value) 输出
+     * */
+    class LogFields {
+    public:
+        static const size_t INLINE_SIZE = 128;
+
+        enum Type : uint8_t {
+            INT = 1,
+            UINT = 2,
+            DOUBLE = 3,
+            BOOL = 4,
+            STRING = 5,
+        };
+
+        // 解码出来的一个字段，key和str指向LogFields内部
+        struct Field {
+            Type type;
+            std::string_view key;
+            union {
+                int64_t i;
+                uint64_t u;
+                double d;
+                bool b;
+            };
+            std::string_view str;
+        };
+
+        LogFields() {}
+        ~LogFields() {
+            if (m_data != m_inline) {
+                delete[] m_data;
+            }
+        }
+        LogFields(const LogFields&) = delete;
+        LogFields& operator=(const LogFields&) = delete;
+
+        // 键超过255字节时截断
+        template<class T>
+        void add(std::string_view key, const T& val) {
+            if constexpr (std::is_same<T, bool>::value) {
+                uint8_t b = val;
+                put(BOOL, key, &b, 1);
+            } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+                int64_t i = val;
+                put(INT, key, &i, sizeof(i));
+            } else if constexpr (std::is_integral<T>::value) {
+                uint64_t u = val;
+                put(UINT, key, &u, sizeof(u));
+            } else if constexpr (std::is_floating_point<T>::value) {
+                double d = val;
+                put(DOUBLE, key, &d, sizeof(d));
+            } else {
+                std::string_view str(val);
+                putString(key, str);
+            }
+        }
+
+        bool empty() const { return m_size == 0; }
+        void clear() { m_size = 0; }
+        // 编码后的原始字节，可用于比较和哈希
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+        // 按添加顺序访问每个字段，f(const Field&)
+        template<class F>
+        void forEach(F f) const {
+            const char* p = m_data;
+            const char* end = m_data + m_size;
+            while (p < end) {
+                Field field;
+                field.type = (Type)p[0];
+                uint8_t klen = p[1];
+                field.key = std::string_view(p + 2, klen);
+                p += 2 + klen;
+                if (field.type == STRING) {
+                    uint32_t len;
+                    memcpy(&len, p, sizeof(len));
+                    field.str = std::string_view(p + sizeof(len), len);
+                    p += sizeof(len) + len;
+                } else if (field.type == BOOL) {
+                    field.b = *p != 0;
+                    p += 1;
+                } else {
+                    memcpy(&field.u, p, sizeof(field.u));
+                    p += sizeof(field.u);
+                }
+                f(field);
+            }
+        }
+
+    private:
+        void put(Type type, std::string_view key, const void* val, size_t len) {
+            char* p = reserve(type, key, len);
+            memcpy(p, val, len);
+        }
+
+        void putString(std::string_view key, std::string_view str) {
+            uint32_t len = str.size();
+            char* p = reserve(STRING, key, sizeof(len) + len);
+            memcpy(p, &len, sizeof(len));
+            memcpy(p + sizeof(len), str.data(), len);
+        }
+
+        // 写好类型和键，返回值应写到的位置
+        char* reserve(Type type, std::string_view key, size_t len) {
+            size_t klen = key.size() < 255 ? key.size() : 255;
+            size_t need = m_size + 2 + klen + len;
+            if (need > m_cap) {
+                grow(need);
+            }
+            char* p = m_data + m_size;
+            p[0] = type;
+            p[1] = (char)klen;
+            memcpy(p + 2, key.data(), klen);
+            m_size = need;
+            return p + 2 + klen;
+        }
+        void grow(size_t need);
+
+    private:
+        char* m_data = m_inline;
+        size_t m_size = 0;
+        size_t m_cap = INLINE_SIZE;
+        char m_inline[INLINE_SIZE];
+    };
+
+// {} 占位符格式化
+    /*
+     * 例如 "user {} took {} ms"，{{ 和 }} 输出字面的 { }
+     * 返回占位符个数，格式串有不成对的 { 或 } 时返回-1
+     * 是constexpr的，对字符串字面量可以在编译期算出来，用于static_assert检查参数个数
+     * */
+    constexpr int CountFormatArgs(const char* fmt) {
+        int n = 0;
+        for (; *fmt; ++fmt) {
+            if (*fmt == '{') {
+                if (fmt[1] == '{') {
+                    ++fmt;
+                } else if (fmt[1] == '}') {
+                    ++fmt;
+                    ++n;
+                } else {
+                    return -1;
+                }
+            } else if (*fmt == '}') {
+                if (fmt[1] == '}') {
+                    ++fmt;
+                } else {
+                    return -1;
+                }
+            }
+        }
+        return n;
+    }
+
+    /*
+     * 把fmt中下一个占位符之前的文本写进ss，fmt前移到占位符之后
+     * 遇到占位符返回true，到结尾返回false
+     * */
+    bool AppendFormatLiteral(LogStream& ss, const char*& fmt);
+
+    inline void FormatTo(LogStream& ss, const char* fmt) {
+        // 参数已经用完，剩下的占位符原样输出
+        while (AppendFormatLiteral(ss, fmt)) {
+            ss.append("{}", 2);
+        }
+    }
+
+    // 参数直接写进事件的缓冲区，数字走 numfmt.h
+    template<class T, class... Args>
+    void FormatTo(LogStream& ss, const char* fmt, const T& val, const Args&... args) {
+        if (!AppendFormatLiteral(ss, fmt)) {
+            return;   // 参数比占位符多，多出来的忽略
+        }
+        ss << val;
+        FormatTo(ss, fmt, args...);
+    }
 
 // 日志事件
     class LogEvent {   // 使每次输出logger变为一个event
@@ -28,18 +353,34 @@ namespace webserver {
         uint32_t m_elapse = 0;   //程序从启动开始到现在的毫秒数
         uint32_t m_threadId = 0;  //线程编号
         uint32_t m_fiberId = 0;  //协程编号
-        uint64_t m_time;        //时间戳
-        std::stringstream m_ss;   //消息
+        uint8_t m_threadNameLen = 0;
+        char m_threadName[THREAD_NAME_SIZE];   //线程名称，拷贝一份，事件可能比线程活得久
+        uint64_t m_time;        //时间戳(秒)
+        uint32_t m_nsec = 0;    //时间戳不足一秒的部分(纳秒)
+        LogStream m_ss;   //消息
+        LogFields m_fields;   //结构化字段
     public:
         typedef std::shared_ptr<LogEvent> ptr;
+
+        /*
+         * 从线程缓存的内存池里创建事件，LogEvent和shared_ptr控制块共用一块池化内存
+         * 事件释放后内存回到池中，稳定运行时不再调用malloc
+         * */
+        static ptr Create(const char* filename, int32_t line, uint32_t elapse,
+                          uint32_t threadid, uint32_t fiberid, uint64_t time, uint32_t nsec = 0) {
+            return std::allocate_shared<LogEvent>(PoolAllocator<LogEvent>(), filename, line,
+                                                  elapse, threadid, fiberid, time, nsec);
+        }
+
         LogEvent(const char* filename, int32_t line, uint32_t elapse,
-                uint32_t threadid, uint32_t fiberid, uint64_t time)
-            : m_filename(filename)
+                uint32_t threadid, uint32_t fiberid, uint64_t time, uint32_t nsec = 0)
+            : m_fileName(filename)
             , m_line(line)
             , m_elapse(elapse)
             , m_threadId(threadid)
             , m_fiberId(fiberid)
-            , m_time(time){
+            , m_time(time)
+            , m_nsec(nsec){
         }
 
         const char* getFile() const {return m_fileName;}
@@ -47,9 +388,21 @@ namespace webserver {
         uint32_t getElapse() const {return m_elapse;}
         uint32_t getThreadId() const {return m_threadId;}
         uint32_t getFiberId() const {return m_fiberId;}
+        std::string_view getThreadName() const {return std::string_view(m_threadName, m_threadNameLen);}
+        void setThreadName(std::string_view name) {
+            m_threadNameLen = name.size() < THREAD_NAME_SIZE ? name.size() : THREAD_NAME_SIZE - 1;
+            memcpy(m_threadName, name.data(), m_threadNameLen);
+        }
         uint64_t getTime() const {return m_time;}
-        std::string getContent() const {return m_ss_str();}
-        const std::stringstream& getSS() {return m_ss;} 
+        uint32_t getNsec() const {return m_nsec;}
+        std::string getContent() const {return m_ss.str();}
+        std::string_view getContentView() const {return m_ss.view();}
+        LogStream& getSS() {return m_ss;}
+
+        // 附加一个结构化字段，例如 event->addField("uid", 42)
+        template<class T>
+        void addField(std::string_view key, const T& val) {m_fields.add(key, val);}
+        const LogFields& getFields() const {return m_fields;}
     };
 
 // 日志级别
@@ -65,36 +418,49 @@ namespace webserver {
             FATAL = 5
         };
         static const char* ToString(LogLevel::Level level);
+        // 不区分大小写，例如 "info" "WARN"，无法识别时返回UNKNOWN
+        static LogLevel::Level FromString(const std::string& str);
 
     };
 
 //日志格式器, 格式化日志
     class LogFormatter {
     public:
-        // 日志解析的子模块
-        /*
-         * 日志内容项格式化
-         */
-        class FormatItem {
-        public:
-            typedef std::shared_ptr<FormatItem> ptr;
-            FormatItem(const std::string& fmt = "") {};
-            virtual ~FormatItem() {}; //析构函数采用虚函数，防止内存泄漏，比如在基类中申请内存，那么虚构函数可以释放
-            /*
-             * 格式化日志流
-             * os 日志输出流
-             * logger 日志器
-             * level 日志等级
-             * event 日志事件
-             * */
-            // 纯虚函数，给个抽象类，提醒必须派生
-            // 传logger进来，不然没法获取logger的private
-            virtual void format(std::shared_ptr<Logger> logger, std::ostream& os, LogLevel::Level level, LogEvent::ptr event) = 0;
-    };
+        /*
+         * 日志模板编译后的指令
+         * inits() 把模板解析成一串扁平的指令，format() 用一个switch循环逐条执行，
+         * 不需要虚函数调用，也不需要stringstream
+         * */
+        enum OpCode : uint8_t {
+            OP_LITERAL = 0,   // 普通文本，m_literals[offset, offset+len)
+            OP_MESSAGE,       // %m 消息
+            OP_LEVEL,         // %p 日志级别
+            OP_ELAPSE,        // %r 累计毫秒数
+            OP_NAME,          // %c 日志名称
+            OP_THREAD_ID,     // %t 线程id
+            OP_FIBER_ID,      // %F 协程号
+            OP_DATETIME,      // %d 时间，见 LogFormatter 构造函数的说明
+            OP_FILENAME,      // %f 文件名称
+            OP_LINE,          // %l 行号
+            OP_NEWLINE,       // %n 换行
+            OP_TAB,           // %T 制表符
+            OP_FIELDS,        // %K 结构化字段，见 %J
+            OP_THREAD_NAME,   // %N 线程名称
+        };
+
+        struct Op {
+            OpCode code;
+            uint8_t digits = 0;   // OP_DATETIME: 秒以下保留几位(0/3/6/9)
+            bool json = false;    // 字符串按JSON转义，OP_FIELDS输出为JSON成员
+            uint32_t offset = 0;  // 在m_literals中的偏移
+            uint32_t len = 0;
+            uint32_t id = 0;      // OP_DATETIME: 线程缓存的编号
+        };
 
     private:
         std::string m_pattern;  // 日志格式模板
-        std::vector<FormatItem::ptr> m_items; //日志解析后所获得的格式
+        std::vector<Op> m_program;  //日志模板编译后的指令
+        std::string m_literals;     //指令引用的文本都放在这一块连续内存里
         bool m_error = false;
 
     public:
@@ -109,12 +475,18 @@ namespace webserver {
          * %c 日志名称
          * %t 线程id
          * %n 换行
-         * %d 时间
+         * %d 时间，%d{xxx} 中xxx为strftime格式，另外支持秒以下的部分：
+         *    %3N 毫秒  %6N 微秒  %9N(或%N) 纳秒，例如 %d{%Y-%m-%d %H:%M:%S.%3N}
+         *    每个线程每秒只调用一次 localtime_r + strftime，其余只改写秒以下的数字
          * %f 文件名称
          * %l 行号
          * %T 制表符
          * %F 协程号
          * %N 线程名称
+         * %K 结构化字段，key=value 以空格分隔，含空格、引号或'='的字符串值加引号
+         * %J 整条日志输出为一个JSON对象(不含换行)：time level logger thread thread_name fiber elapse file line msg
+         *    之后是结构化字段，%J{xxx} 中xxx为time的格式，默认 %Y-%m-%dT%H:%M:%S.%6N%z
+         *    例如 "%J%n" 每行一个JSON，日志管道不用再正则解析
          *
          * 默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
          * */
@@ -126,12 +498,20 @@ namespace webserver {
          * level 级别
          * event 事件
          * */
-        std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);    //把event存为一个string，给Appender输出
+        std::string format(const Logger& logger, LogLevel::Level level, const LogEvent& event);    //把event存为一个string，给Appender输出
 
         /*
-         * 初始化解析日志模板
+         * 把格式化结果追加到调用者提供的缓冲区out
+         * out 可以反复使用(clear()不释放容量)，稳定之后每行日志不再分配内存
+         * */
+        void format(std::string& out, const Logger& logger, LogLevel::Level level, const LogEvent& event);
+
+        /*
+         * 初始化解析日志模板，编译成m_program
          * */
         void inits();
+        // 模板中有无法解析的部分
+        bool isError() const { return m_error; }
         const std::string getFormatter() const { return m_pattern; }
         // getFormatter的返回值不允许被更改
         // 第二个const使得该函数的权限为只读，即无法去改变成员变量的值
@@ -142,57 +522,309 @@ namespace webserver {
 //日志输出的地方
     class LogAppender {
     protected:
-        LogLevel::Level m_level;   // Appender针对哪些等级的日志
+        std::atomic<LogLevel::Level> m_level{LogLevel::DEBUG};   // Appender针对哪些等级的日志
         LogFormatter::ptr m_formatter;  // 日志格式器
+        PolicyMutex m_mutex;            // 保护输出目标，多个线程可能同时写同一个appender
     public:
         typedef std::shared_ptr<LogAppender> ptr;
 
         virtual ~LogAppender() {}
 
         // 把logger传到appender，方便后续输出logger的名称，不然没法获取private
-        virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+        // logger和event只在调用期间有效，不传递所有权，避免每条日志每个appender都改一次引用计数
+        // 级别已经由Logger按级别分好的appender表过滤，log/logFormatted里不再判断m_level
+        // 被包装的appender(AsyncLogAppender/DedupLogAppender的backend)的级别不起作用，设在外层
+        virtual void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) = 0;
+
+        /*
+         * 直接输出已经格式化好的日志文本
+         * AsyncLogAppender 的后台线程把整块缓冲区交给被包装的appender
+         * */
+        virtual void write(const char* data, size_t len) = 0;
+
+        /*
+         * 输出一条已经用本appender的formatter格式化好的日志
+         * Logger对共用同一个formatter的appender只格式化一次，再把同一块文本交给它们
+         * 默认忽略文本，交给log()自己格式化；只输出文本的appender覆盖为直接write()
+         * */
+        virtual void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                  const char* data, size_t len) {
+            log(logger, level, event);
+        }
+
+        // 把appender内部缓冲的数据刷到目标
+        virtual void flush() {}
+
+        /*
+         * 进程崩溃时由信号处理函数调用(见CrashHandler)
+         * 必须是异步信号安全的：不加锁、不分配内存，只用write/pwrite/memcpy
+         * 持有锁的线程已经停在信号里，读到的缓冲区可能不完整，尽力而为
+         * emergencyFlush 把内部还没输出的数据写到目标
+         * emergencyWrite 直接输出一段文本(崩溃信息和调用栈)
+         * */
+        virtual void emergencyFlush() {}
+        virtual void emergencyWrite(const char* data, size_t len) {}
 
         void setFormatter(LogFormatter::ptr val) {
             m_formatter = val;
         }
 
-        LogFormatter::ptr getFormatter() const {
+        const LogFormatter::ptr& getFormatter() const {
             return m_formatter;
         }
+
+        LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+        /*
+         * 修改级别后递增全局的版本号，Logger在下一次dispatch时发现版本变了，
+         * 重建按级别分好的appender表
+         * */
+        void setLevel(LogLevel::Level val) {
+            m_level.store(val, std::memory_order_relaxed);
+            s_levelVersion.fetch_add(1, std::memory_order_release);
+        }
+        static uint32_t GetLevelVersion() { return s_levelVersion.load(std::memory_order_acquire); }
+
+        /*
+         * 选择输出时的加锁方式，默认MUTEX
+         * 只在单线程里使用时可以设为NONE，临界区很短(比如只拷贝内存)时可以设为SPIN
+         * 应在开始打日志之前设置
+         * */
+        void setLockPolicy(PolicyMutex::Policy policy) { m_mutex.setPolicy(policy); }
+        PolicyMutex::Policy getLockPolicy() const { return m_mutex.getPolicy(); }
+
+    private:
+        static std::atomic<uint32_t> s_levelVersion;   // 只在setLevel时写，日志路径只读
+    };
+
+// 格式串，顺带记录调用处的文件名和行号(GCC/Clang的内建函数，作为默认参数时取调用者的位置)
+    struct LogFormatString {
+        LogFormatString(const char* s, const char* f = __builtin_FILE(), int32_t l = __builtin_LINE())
+            : str(s), file(f), line(l) {}
+        const char* str;
+        const char* file;
+        int32_t line;
     };
 
 //日志器
     class Logger : public std::enable_shared_from_this<Logger> {
     private:
-        LogLevel::Level m_level;   //定义日志器的级别,满足这个级别的才会被记录
+        std::atomic<LogLevel::Level> m_level;   //定义日志器的级别,满足这个级别的才会被记录
         std::string m_name;      //日志器logger名称
-        std::list<LogAppender::ptr> m_appenders;       // Appender集合
+        /*
+         * Appender集合：不可变的快照，修改时复制一份新的整体替换，
+         * 日志路径用危险指针读取，不加锁，旧快照在没有读者后释放
+         * 快照里按级别预先分好组，byLevel[level] 正好是接受该级别的appender，
+         * dispatch只需取出一组依次调用，不再逐个比较级别
+         * */
+        typedef std::vector<LogAppender::ptr> AppenderList;
+        struct AppenderTable {
+            AppenderList all;
+            std::vector<LogAppender*> byLevel[LogLevel::FATAL + 1];
+            uint32_t levelVersion = 0;   // 建表时的LogAppender::GetLevelVersion()
+        };
+        std::atomic<const AppenderTable*> m_appenders;
+        Mutex m_appenderMutex;   // 串行化addAppender/delAppender/重建
+        LogFormatter::ptr m_formatter;   // 默认的formatter，appender没有设置时使用
+        RWMutex m_configMutex;           // 保护m_formatter，读多写少
+
+        // 异步模式下投递给消费者线程的日志
+        struct QueuedEvent {
+            LogLevel::Level level = LogLevel::UNKNOWN;
+            LogEvent::ptr event;
+        };
+        // 为空表示同步模式；startAsync可以在打日志的过程中调用，所以是原子的
+        std::atomic<MpscRingBuffer<QueuedEvent>*> m_queue{nullptr};
+        std::thread m_consumer;
+        std::atomic<bool> m_asyncRunning{false};
+        std::atomic<size_t> m_consumed{0};   // 消费者已经处理完的日志数
+    public:
+        // 异步队列满时的处理方式
+        enum OverflowPolicy {
+            OVERFLOW_BLOCK = 0,              // 生产者让出CPU等待，不丢日志(默认)
+            OVERFLOW_DROP_NEWEST = 1,        // 丢弃当前这条
+            OVERFLOW_DROP_BELOW_LEVEL = 2,   // 低于keep_level的丢弃，其余等待
+            OVERFLOW_SPILL = 3,              // 在调用线程里格式化后写到溢出文件，没有设置溢出文件时等待
+        };
+    private:
+        std::atomic<OverflowPolicy> m_overflowPolicy{OVERFLOW_BLOCK};
+        std::atomic<LogLevel::Level> m_overflowKeepLevel{LogLevel::WARN};
+        // 溢出文件，和appender表一样整体替换，生产者用危险指针读取
+        struct SpillTarget {
+            std::shared_ptr<FileLogAppender> appender;
+        };
+        std::atomic<const SpillTarget*> m_spill{nullptr};
+        std::atomic<uint64_t> m_dropped{0};   // 因队列满丢弃的日志数
+        std::atomic<uint64_t> m_spilled{0};   // 因队列满写进溢出文件的日志数
+        std::atomic<int> m_overflowReportMs{10000};
+
+        // 把日志交给所有appender，共用formatter的appender只格式化一次
+        void dispatch(LogLevel::Level level, const LogEvent& event);
+        // 队列满时按m_overflowPolicy处理，不在热路径上
+        void pushOverflow(QueuedEvent& e);
+        // 消费者线程把上次汇报以来的丢弃/溢出条数写成一条WARN日志
+        void reportOverflow(uint64_t& dropped, uint64_t& spilled);
+        // 用list建一张新表替换当前的，持有m_appenderMutex时调用
+        void publishAppenders(AppenderList list);
+        // appender的级别变了，按当前的appender重建
+        void rebuildAppenders();
+        // dropped/spilled 为startAsync时的计数，之后增加的才汇报
+        void consume(uint64_t dropped, uint64_t spilled);
     public:
         typedef std::shared_ptr<Logger> ptr;
 
         Logger(const std::string &name = "root");
+        ~Logger();
         void log(LogLevel::Level level, LogEvent::ptr event);
 
+        /*
+         * 开启异步模式
+         * log() 只把事件放进无锁的MPSC环形队列，由单独的消费者线程交给appender
+         * capacity 队列容量，满了之后按setOverflowPolicy的策略处理
+         * 可以在其他线程打日志的过程中调用(之前的日志同步输出，之后的进队列)，重复调用只开启一次
+         * */
+        void startAsync(size_t capacity = 65536);
+
+        /*
+         * 队列满时的策略，可以在运行中修改
+         * 宁可丢DEBUG/INFO也不能卡住请求线程时用 OVERFLOW_DROP_BELOW_LEVEL
+         * keep_level 只对OVERFLOW_DROP_BELOW_LEVEL有效
+         * */
+        void setOverflowPolicy(OverflowPolicy policy, LogLevel::Level keep_level = LogLevel::WARN);
+        OverflowPolicy getOverflowPolicy() const { return m_overflowPolicy.load(std::memory_order_relaxed); }
+
+        /*
+         * OVERFLOW_SPILL 使用的溢出文件(建议放在本地磁盘)，格式用logger的默认formatter
+         * 溢出的日志和队列里的日志之间不保证先后顺序
+         * 可以在运行中替换，正在写旧文件的调用写完后旧文件才关闭；打开失败返回false，保留原来的
+         * */
+        bool setSpillFile(const std::string& filename);
+        // 同上，appender由调用者创建好(比如配置加载时先检查能否打开)
+        void setSpillAppender(std::shared_ptr<FileLogAppender> appender);
+        // 当前的溢出文件名，没有设置时为空
+        std::string getSpillFile();
+
+        /*
+         * 消费者线程每隔interval_ms检查一次计数，有新的丢弃或溢出时，
+         * 直接输出一条WARN日志(不经过队列)，带结构化字段 dropped spilled
+         * */
+        void setOverflowReportInterval(int interval_ms) { m_overflowReportMs.store(interval_ms, std::memory_order_relaxed); }
+        uint64_t getDroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+        uint64_t getSpilledCount() const { return m_spilled.load(std::memory_order_relaxed); }
+        // 停止异步模式，队列中剩余的日志会先处理完；必须在没有其他线程打日志时调用
+        void stopAsync();
+        // 等待已经提交的日志全部交给appender，并刷新appender
+        void flush();
+
+        /*
+         * 崩溃时使用，异步信号安全
+         * emergencyFlush 先让各appender输出内部缓冲，再把异步队列里还没处理的日志
+         * 以简化的格式 "[LEVEL] file:line message" 写出去
+         * emergencyWrite 把一段文本直接交给所有appender
+         * */
+        void emergencyFlush();
+        void emergencyWrite(const char* data, size_t len);
+
         void debug(LogEvent::ptr event);
         void info(LogEvent::ptr event);
         void warn(LogEvent::ptr event);
         void error(LogEvent::ptr event);
         void fatal(LogEvent::ptr event);
+
+        /*
+         * 格式化方式写日志，例如 logger->info("user {} took {} ms", id, ms);
+         * 级别不够时直接返回，不创建事件
+         * 占位符和参数个数只能在运行时对齐，需要编译期检查请用 WEBSERVER_LOG_FMT_XXX 宏
+         * 函数里没有调用点的静态LogSite，不受LogRateLimiter的按调用点限流，需要限流的地方请用宏
+         * */
+        template<class... Args>
+        void log(LogLevel::Level level, LogFormatString fmt, const Args&... args);
+        template<class... Args>
+        void debug(LogFormatString fmt, const Args&... args) { log(LogLevel::DEBUG, fmt, args...); }
+        template<class... Args>
+        void info(LogFormatString fmt, const Args&... args) { log(LogLevel::INFO, fmt, args...); }
+        template<class... Args>
+        void warn(LogFormatString fmt, const Args&... args) { log(LogLevel::WARN, fmt, args...); }
+        template<class... Args>
+        void error(LogFormatString fmt, const Args&... args) { log(LogLevel::ERROR, fmt, args...); }
+        template<class... Args>
+        void fatal(LogFormatString fmt, const Args&... args) { log(LogLevel::FATAL, fmt, args...); }
+
         void addAppender(LogAppender::ptr appender);
         void delAppender(LogAppender::ptr appender);
-        LogLevel::Level getLevel() const { return m_level; }
-        void setLevel(LogLevel::Level val) { m_level = val; }
+        /*
+         * 整体替换appender集合，一次原子的快照替换
+         * 正在进行的日志调用继续使用旧的集合，不会丢失也不会被阻塞
+         * */
+        void setAppenders(const std::vector<LogAppender::ptr>& appenders);
+        std::vector<LogAppender::ptr> getAppenders();
+        LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+        void setLevel(LogLevel::Level val) { m_level.store(val, std::memory_order_relaxed); }
+
+        // 默认formatter，之后添加的没有formatter的appender使用它
+        void setFormatter(LogFormatter::ptr val);
+        LogFormatter::ptr getFormatter();
 
         const std::string& getName() const { return m_name;}
     };
 
+// 日志事件包装器，在析构时(也就是WEBSERVER_LOG_XXX语句结束时)把事件交给logger
+    class LogEventWrap {
+    public:
+        // 创建事件，并填上时间、线程号、线程名称、启动毫秒数(线程信息取自线程缓存，不进内核)
+        LogEventWrap(Logger* logger, LogLevel::Level level, const char* file, int32_t line);
+        ~LogEventWrap();
+
+        LogEvent::ptr getEvent() const { return m_event; }
+        LogStream& getSS() { return m_event->getSS(); }
+
+        // 附加结构化字段，可以连写
+        template<class T>
+        LogEventWrap& with(std::string_view key, const T& val) {
+            m_event->addField(key, val);
+            return *this;
+        }
+
+        // 流式写消息，之后的 << 直接作用在LogStream上
+        template<class T>
+        LogStream& operator<<(const T& val) { return getSS() << val; }
+
+        /*
+         * N 是编译期算出的占位符个数(CountFormatArgs)，由 WEBSERVER_LOG_FMT_XXX 宏传入
+         * 格式串写错或参数个数不对时编译失败
+         * */
+        template<int N, class... Args>
+        void format(const char* fmt, const Args&... args) {
+            static_assert(N >= 0, "log format string has unmatched '{' or '}'");
+            static_assert(N == sizeof...(Args), "log format placeholders do not match the number of arguments");
+            FormatTo(m_event->getSS(), fmt, args...);
+        }
+    private:
+        Logger* m_logger;   // 只在一条语句内有效，不需要持有所有权
+        LogLevel::Level m_level;
+        LogEvent::ptr m_event;
+    };
+
+    template<class... Args>
+    void Logger::log(LogLevel::Level level, LogFormatString fmt, const Args&... args) {
+        if (level < m_level) {
+            return;
+        }
+        LogEventWrap wrap(this, level, fmt.file, fmt.line);
+        FormatTo(wrap.getSS(), fmt.str, args...);
+    }
+
 
 // 输出到控制台的Appender
     class StdoutLogAppender : public LogAppender {
     public:
         typedef std::shared_ptr<StdoutLogAppender> ptr;
 
-        void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+        void write(const char* data, size_t len) override;
+        void flush() override;
+        void emergencyWrite(const char* data, size_t len) override;
     };
 
 
@@ -200,15 +832,70 @@ namespace webserver {
     class FileLogAppender : public LogAppender {
     public:
         typedef std::shared_ptr<FileLogAppender> ptr;
+
+        // 按时间切分的周期
+        enum RotateInterval {
+            ROTATE_NONE = 0,
+            ROTATE_HOURLY = 1,
+            ROTATE_DAILY = 2,
+        };
+
+        /*
+         * 日志切分策略
+         * 切分时把当前文件改名为 name.YYYYMMDD-HH.N (文件开始写入时的日期和小时，N为同一小时内的序号)，
+         * 然后重新打开name继续写；压缩和清理旧文件由LogRotator的后台线程完成
+         * */
+        struct RotatePolicy {
+            uint64_t max_size = 0;                  // 文件超过多少字节切分，0表示不按大小切分
+            RotateInterval interval = ROTATE_NONE;  // 按小时/天切分
+            bool compress = true;                   // 切分出来的文件是否gzip压缩
+            size_t max_files = 0;                   // 最多保留多少个切分出来的文件，0表示不限
+            uint64_t max_total_size = 0;            // 切分出来的文件总共最多占多少字节，0表示不限
+        };
+
         FileLogAppender(const std::string& filename);
-        void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+        ~FileLogAppender();
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+        void write(const char* data, size_t len) override;
+        void flush() override;
+        void emergencyFlush() override;
+        void emergencyWrite(const char* data, size_t len) override;
 
         // 判断文件是否打开，已经打开则关闭重新打开,成功返回true
         bool reopen();
 
+        void setRotatePolicy(const RotatePolicy& policy);
+        const RotatePolicy& getRotatePolicy() const { return m_rotate; }
+        // 立即切分一次
+        bool rotate();
+
+        const std::string& getFilename() const { return m_filename; }
+
+    private:
+        // 以下在持有m_mutex时调用
+        bool doReopen();
+        bool doRotate();
+        // 计算下一个按时间切分的时刻
+        void updateNextRotateTime();
+        // 把m_buf中的数据写进文件
+        void flushBuffer();
+
     private:
+        // 自己管理缓冲区而不用ofstream，崩溃时才能在信号处理函数里直接write出去
+        static const size_t BUFFER_SIZE = 64 * 1024;
+
         std::string m_filename;
-        std::ofstream m_filestream;
+        int m_fd = -1;
+        std::unique_ptr<char[]> m_buf;
+        size_t m_bufLen = 0;
+        RotatePolicy m_rotate;
+        uint64_t m_fileSize = 0;      // 当前文件大小
+        time_t m_openTime = 0;        // 当前文件开始写入的时间，用于切分后的文件名
+        time_t m_nextRotateTime = 0;  // 按时间切分的下一个时刻
+        std::string m_rotateStamp;    // 切分文件名的序号缓存，见LogRotator::MakeRotatedName
+        int m_rotateSeq = 0;
     };
 }
 #endif
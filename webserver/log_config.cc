@@ -0,0 +1,445 @@
+#include "log_config.h"
+#include "async_appender.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+namespace webserver {
+
+    bool LogAppenderDefine::canReuse(const LogAppenderDefine& o) const {
+        return type == o.type && file == o.file && formatter == o.formatter
+            && async == o.async && rotate.max_size == o.rotate.max_size
+            && rotate.interval == o.rotate.interval && rotate.compress == o.rotate.compress
+            && rotate.max_files == o.rotate.max_files && rotate.max_total_size == o.rotate.max_total_size;
+    }
+
+    static std::string Trim(const std::string& str) {
+        size_t begin = str.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            return "";
+        }
+        size_t end = str.find_last_not_of(" \t\r");
+        return str.substr(begin, end - begin + 1);
+    }
+
+    // 行内注释要求前面有空白，格式模板里的'#'/';'不受影响
+    static std::string StripComment(const std::string& line) {
+        for (size_t i = 1; i < line.size(); ++i) {
+            if ((line[i] == '#' || line[i] == ';') && (line[i - 1] == ' ' || line[i - 1] == '\t')) {
+                return line.substr(0, i);
+            }
+        }
+        return line;
+    }
+
+    static bool ParseBool(const std::string& str, bool& val) {
+        if (str == "true" || str == "yes" || str == "on" || str == "1") {
+            val = true;
+        } else if (str == "false" || str == "no" || str == "off" || str == "0") {
+            val = false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    template<class T>
+    static bool ParseUInt(const std::string& str, T& val) {
+        auto res = std::from_chars(str.data(), str.data() + str.size(), val);
+        return res.ec == std::errc() && res.ptr == str.data() + str.size();
+    }
+
+    static bool ParseAppenderKey(LogAppenderDefine& def, const std::string& key, const std::string& val) {
+        if (key == "type") {
+            def.type = val;
+            return val == "stdout" || val == "file";
+        } else if (key == "file") {
+            def.file = val;
+            return !val.empty();
+        } else if (key == "level") {
+            def.level = LogLevel::FromString(val);
+            return def.level != LogLevel::UNKNOWN;
+        } else if (key == "formatter") {
+            def.formatter = val;
+            return true;
+        } else if (key == "async") {
+            return ParseBool(val, def.async);
+        } else if (key == "max_size") {
+            return ParseUInt(val, def.rotate.max_size);
+        } else if (key == "rotate") {
+            if (val == "none") {
+                def.rotate.interval = FileLogAppender::ROTATE_NONE;
+            } else if (val == "hourly") {
+                def.rotate.interval = FileLogAppender::ROTATE_HOURLY;
+            } else if (val == "daily") {
+                def.rotate.interval = FileLogAppender::ROTATE_DAILY;
+            } else {
+                return false;
+            }
+            return true;
+        } else if (key == "compress") {
+            return ParseBool(val, def.rotate.compress);
+        } else if (key == "max_files") {
+            return ParseUInt(val, def.rotate.max_files);
+        } else if (key == "max_total_size") {
+            return ParseUInt(val, def.rotate.max_total_size);
+        }
+        return false;
+    }
+
+    static bool ParseLoggerKey(LoggerDefine& def, const std::string& key, const std::string& val) {
+        if (key == "level") {
+            def.level = LogLevel::FromString(val);
+            return def.level != LogLevel::UNKNOWN;
+        } else if (key == "appenders") {
+            def.appenders.clear();
+            std::stringstream ss(val);
+            std::string name;
+            while (std::getline(ss, name, ',')) {
+                name = Trim(name);
+                if (!name.empty()) {
+                    def.appenders.push_back(name);
+                }
+            }
+            return true;
+        } else if (key == "overflow") {
+            if (val == "block") {
+                def.overflow = Logger::OVERFLOW_BLOCK;
+            } else if (val == "drop_newest") {
+                def.overflow = Logger::OVERFLOW_DROP_NEWEST;
+            } else if (val == "drop_below_level") {
+                def.overflow = Logger::OVERFLOW_DROP_BELOW_LEVEL;
+            } else if (val == "spill") {
+                def.overflow = Logger::OVERFLOW_SPILL;
+            } else {
+                return false;
+            }
+            return true;
+        } else if (key == "overflow_level") {
+            def.overflowLevel = LogLevel::FromString(val);
+            return def.overflowLevel != LogLevel::UNKNOWN;
+        } else if (key == "async_queue") {
+            return ParseUInt(val, def.asyncQueue) && def.asyncQueue > 0;
+        } else if (key == "spill_file") {
+            def.spillFile = val;
+            return !val.empty();
+        }
+        return false;
+    }
+
+    bool LogConfig::Parse(const std::string& text, LogConfig& config, std::string& error) {
+        LogConfig result;
+        LogAppenderDefine* appender = nullptr;
+        LoggerDefine* logger = nullptr;
+        std::stringstream ss(text);
+        std::string line;
+        for (int lineno = 1; std::getline(ss, line); ++lineno) {
+            line = Trim(line);
+            if (line.empty() || line[0] == '#' || line[0] == ';') {
+                continue;
+            }
+            line = Trim(StripComment(line));
+            if (line[0] == '[') {
+                if (line.back() != ']') {
+                    error = std::to_string(lineno) + ": missing ']'";
+                    return false;
+                }
+                std::string section = Trim(line.substr(1, line.size() - 2));
+                appender = nullptr;
+                logger = nullptr;
+                if (section.compare(0, 9, "appender.") == 0 && section.size() > 9) {
+                    appender = &result.appenders[section.substr(9)];
+                } else if (section.compare(0, 7, "logger.") == 0 && section.size() > 7) {
+                    logger = &result.loggers[section.substr(7)];
+                } else {
+                    error = std::to_string(lineno) + ": unknown section [" + section + "]";
+                    return false;
+                }
+                continue;
+            }
+
+            size_t pos = line.find('=');
+            if (pos == std::string::npos) {
+                error = std::to_string(lineno) + ": expect key = value";
+                return false;
+            }
+            std::string key = Trim(line.substr(0, pos));
+            std::string val = Trim(line.substr(pos + 1));
+            bool ok;
+            if (appender) {
+                ok = ParseAppenderKey(*appender, key, val);
+            } else if (logger) {
+                ok = ParseLoggerKey(*logger, key, val);
+            } else {
+                ok = key == "formatter";
+                if (ok) {
+                    result.formatter = val;
+                }
+            }
+            if (!ok) {
+                error = std::to_string(lineno) + ": invalid " + key + " = " + val;
+                return false;
+            }
+        }
+
+        for (auto& i : result.appenders) {
+            if (i.second.type.empty()) {
+                error = "appender " + i.first + ": missing type";
+                return false;
+            }
+            if (i.second.type == "file" && i.second.file.empty()) {
+                error = "appender " + i.first + ": missing file";
+                return false;
+            }
+            if (i.second.formatter.empty()) {
+                i.second.formatter = result.formatter;
+            }
+        }
+        for (auto& i : result.loggers) {
+            for (auto& name : i.second.appenders) {
+                if (!result.appenders.count(name)) {
+                    error = "logger " + i.first + ": unknown appender " + name;
+                    return false;
+                }
+            }
+            // 溢出策略只对异步队列生效，配了却不起作用的直接报错
+            const LoggerDefine& def = i.second;
+            if ((def.overflow != Logger::OVERFLOW_BLOCK || !def.spillFile.empty()) && !def.asyncQueue) {
+                error = "logger " + i.first + ": overflow/spill_file requires async_queue";
+                return false;
+            }
+            if (def.overflow == Logger::OVERFLOW_SPILL && def.spillFile.empty()) {
+                error = "logger " + i.first + ": overflow = spill requires spill_file";
+                return false;
+            }
+        }
+        config = std::move(result);
+        return true;
+    }
+
+    LogManager* LogManager::GetInstance() {
+        // 不析构，进程退出时其他静态对象的析构里可能还在打日志
+        static LogManager* s_instance = new LogManager;
+        return s_instance;
+    }
+
+    LogManager::~LogManager() {
+        stopWatch();
+    }
+
+    Logger::ptr LogManager::getLogger(const std::string& name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Logger::ptr& logger = m_loggers[name];
+        if (!logger) {
+            logger.reset(new Logger(name));
+        }
+        return logger;
+    }
+
+    bool LogManager::load(const std::string& filename) {
+        std::ifstream ifs(filename);
+        if (!ifs) {
+            std::cout << "LogManager load " << filename << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        LogConfig config;
+        std::string error;
+        if (!LogConfig::Parse(ss.str(), config, error) || !apply(config, error)) {
+            std::cout << "LogManager load " << filename << " failed: " << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool LogManager::apply(const LogConfig& config, std::string& error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // 第一步：创建appender、编译formatter，都不影响正在使用的配置
+        // 相同的格式模板共用一个formatter，dispatch时只格式化一次
+        std::map<std::string, LogFormatter::ptr> formatters;
+        std::map<std::string, std::pair<LogAppenderDefine, LogAppender::ptr>> appenders;
+        for (auto& i : config.appenders) {
+            auto it = m_appenders.find(i.first);
+            if (it != m_appenders.end() && it->second.first.canReuse(i.second)) {
+                appenders[i.first] = std::make_pair(i.second, it->second.second);
+                if (!i.second.formatter.empty()) {
+                    formatters[i.second.formatter] = it->second.second->getFormatter();
+                }
+            }
+        }
+        for (auto& i : config.appenders) {
+            const LogAppenderDefine& def = i.second;
+            if (appenders.count(i.first)) {
+                continue;
+            }
+            LogFormatter::ptr formatter;
+            if (!def.formatter.empty()) {
+                LogFormatter::ptr& f = formatters[def.formatter];
+                if (!f) {
+                    f.reset(new LogFormatter(def.formatter));
+                    if (f->isError()) {
+                        error = "appender " + i.first + ": invalid formatter " + def.formatter;
+                        return false;
+                    }
+                }
+                formatter = f;
+            }
+
+            LogAppender::ptr appender;
+            if (def.type == "stdout") {
+                appender.reset(new StdoutLogAppender);
+            } else {
+                FileLogAppender::ptr file(new FileLogAppender(def.file));
+                if (!file->reopen()) {
+                    error = "appender " + i.first + ": open " + def.file + " failed";
+                    return false;
+                }
+                file->setRotatePolicy(def.rotate);
+                appender = file;
+            }
+            if (def.async) {
+                appender.reset(new AsyncLogAppender(appender));
+            }
+            appender->setFormatter(formatter);   // 为空时由Logger::setAppenders设为logger的默认格式
+            appender->setLevel(def.level);
+            appenders[i.first] = std::make_pair(def, appender);
+        }
+
+        // 溢出文件变了的logger先打开新文件
+        std::map<std::string, FileLogAppender::ptr> spills;
+        for (auto& i : config.loggers) {
+            const std::string& file = i.second.spillFile;
+            auto it = m_loggers.find(i.first);
+            if (file.empty() || (it != m_loggers.end() && it->second->getSpillFile() == file)) {
+                continue;
+            }
+            FileLogAppender::ptr spill(new FileLogAppender(file));
+            if (!spill->reopen()) {
+                error = "logger " + i.first + ": open " + file + " failed";
+                return false;
+            }
+            spills[i.first] = spill;
+        }
+
+        // 第二步：沿用的appender只改了级别的直接修改，Logger在下一次dispatch时重建按级别分好的表
+        for (auto& i : appenders) {
+            if (i.second.second->getLevel() != i.second.first.level) {
+                i.second.second->setLevel(i.second.first.level);
+            }
+        }
+
+        // 逐个logger替换，先换appender再改级别，调高详细程度时新级别的日志不会落到旧appender
+        for (auto& i : config.loggers) {
+            std::vector<LogAppender::ptr> list;
+            for (auto& name : i.second.appenders) {
+                list.push_back(appenders[name].second);
+            }
+            Logger::ptr& logger = m_loggers[i.first];
+            if (!logger) {
+                logger.reset(new Logger(i.first));
+            }
+            logger->setAppenders(list);
+            logger->setLevel(i.second.level);
+            auto it = spills.find(i.first);
+            if (it != spills.end()) {
+                it->second->setFormatter(logger->getFormatter());
+                logger->setSpillAppender(it->second);
+            } else if (i.second.spillFile.empty()) {
+                logger->setSpillAppender(nullptr);
+            }
+            // 先准备好溢出文件再开启异步，开启后的第一次溢出就能写进去
+            logger->setOverflowPolicy(i.second.overflow, i.second.overflowLevel);
+            if (i.second.asyncQueue) {
+                logger->startAsync(i.second.asyncQueue);
+            }
+        }
+
+        // 被替换掉的appender先把缓冲的日志写出去，还在用旧快照的调用在析构时写完
+        for (auto& i : m_appenders) {
+            auto it = appenders.find(i.first);
+            if (it == appenders.end() || it->second.second != i.second.second) {
+                i.second.second->flush();
+            }
+        }
+        m_appenders.swap(appenders);
+        m_reloads.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool LogManager::watch(const std::string& filename) {
+        stopWatch();
+        bool ok = load(filename);
+
+        size_t pos = filename.rfind('/');
+        std::string dir = pos == std::string::npos ? "." : filename.substr(0, pos + 1);   // 监视目录，文件被rename替换后仍然有效
+        std::string name = pos == std::string::npos ? filename : filename.substr(pos + 1);
+        int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0 || inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            std::cout << "LogManager watch " << filename << " failed: " << strerror(errno) << std::endl;
+            if (inotify_fd >= 0) {
+                ::close(inotify_fd);
+            }
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        m_stopFd = eventfd(0, EFD_CLOEXEC);
+        m_watchThread = std::thread(&LogManager::watchLoop, this, inotify_fd, filename, name);
+        return ok;
+    }
+
+    void LogManager::stopWatch() {
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        if (!m_watchThread.joinable()) {
+            return;
+        }
+        uint64_t one = 1;
+        ssize_t rt = ::write(m_stopFd, &one, sizeof(one));   // eventfd的计数器不会溢出，写不会失败
+        (void)rt;
+        m_watchThread.join();
+        ::close(m_stopFd);
+        m_stopFd = -1;
+    }
+
+    void LogManager::watchLoop(int inotify_fd, std::string path, std::string name) {
+        SetThreadName("log_config");
+        alignas(struct inotify_event) char buf[4096];
+        struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {m_stopFd, POLLIN, 0}};
+        while (true) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents) {
+                break;
+            }
+            // 一次读出所有事件，同一次保存产生的多个事件只重新加载一次
+            bool changed = false;
+            ssize_t n;
+            while ((n = ::read(inotify_fd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + n; ) {
+                    struct inotify_event* ev = (struct inotify_event*)p;
+                    if (ev->len && name == ev->name) {
+                        changed = true;
+                    }
+                    p += sizeof(struct inotify_event) + ev->len;
+                }
+            }
+            if (changed) {
+                load(path);
+            }
+        }
+        ::close(inotify_fd);
+    }
+}
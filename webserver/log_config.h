@@ -0,0 +1,128 @@
+#ifndef __WEBSERVER_LOG_CONFIG_H__
+#define __WEBSERVER_LOG_CONFIG_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "log.h"
+
+namespace webserver {
+
+// 日志配置文件
+    /*
+     * INI格式，'#'或';'开头的行是注释，值两边的空白会去掉：
+     *
+     *   formatter = %d%T[%p]%T%m%n         # 段之前的是全局项：appender的默认格式
+     *
+     *   [appender.console]
+     *   type = stdout                      # stdout / file
+     *   level = debug                      # 可选，默认debug
+     *   formatter = %d%T%N%T[%p]%T%m%n     # 可选，默认用全局的formatter
+     *
+     *   [appender.main]
+     *   type = file
+     *   file = /var/log/app.log
+     *   level = info
+     *   async = true                       # 可选，套一层AsyncLogAppender
+     *   max_size = 104857600               # 可选，切分策略，见FileLogAppender::RotatePolicy
+     *   rotate = daily                     # none / hourly / daily
+     *   compress = true
+     *   max_files = 7
+     *
+     *   [logger.root]
+     *   level = info
+     *   appenders = console, main          # 多个logger可以共用同一个appender
+     *   async_queue = 65536                # 可选，开启Logger的异步模式，值为队列容量
+     *   overflow = spill                   # 可选，队列满时的策略，见Logger::OverflowPolicy，需要async_queue
+     *   overflow_level = warn              #   block / drop_newest / drop_below_level / spill
+     *   spill_file = /data/log/spill.log   # overflow = spill 时必须配置
+     * */
+    struct LogAppenderDefine {
+        std::string type;
+        std::string file;
+        LogLevel::Level level = LogLevel::DEBUG;
+        std::string formatter;
+        bool async = false;
+        FileLogAppender::RotatePolicy rotate;
+
+        /*
+         * 除级别外都相同时可以沿用已有的appender(级别直接setLevel修改)
+         * 同一个文件不能同时有两个FileLogAppender：各自的缓冲区会让日志乱序，切分也各算各的
+         * */
+        bool canReuse(const LogAppenderDefine& o) const;
+    };
+
+    struct LoggerDefine {
+        LogLevel::Level level = LogLevel::DEBUG;
+        std::vector<std::string> appenders;
+        Logger::OverflowPolicy overflow = Logger::OVERFLOW_BLOCK;
+        LogLevel::Level overflowLevel = LogLevel::WARN;
+        size_t asyncQueue = 0;   // 为0时保持同步
+        std::string spillFile;
+    };
+
+    struct LogConfig {
+        std::string formatter;   // 全局默认格式，为空时用Logger自带的默认格式
+        std::map<std::string, LogAppenderDefine> appenders;
+        std::map<std::string, LoggerDefine> loggers;
+
+        // 解析INI文本，出错时返回false，error为 "行号: 原因"
+        static bool Parse(const std::string& text, LogConfig& config, std::string& error);
+    };
+
+// 按名称管理logger，应用配置并在配置文件变化时重新加载
+    /*
+     * 应用配置分两步：
+     *   1. 在调用线程(重新加载时是监视线程)里创建所有appender、编译所有LogFormatter，
+     *      任何一处出错则放弃整份配置，正在使用的配置不受影响
+     *   2. 逐个logger用Logger::setAppenders原子地替换appender快照，再设置级别
+     * 日志线程不加锁读快照，替换期间的日志写到旧的或新的appender，不会丢失，也不会等待；
+     * 旧的appender在最后一个读者离开后析构，析构时把缓冲的数据写完
+     * 除级别外定义没有变化的appender直接沿用(文件不重新打开，缓冲区不清空)，级别在原对象上修改
+     * 配置里删掉的logger保持最后一次的配置
+     * 异步模式开启后不会因为重新加载而关闭，队列容量也以第一次开启时为准；溢出文件可以随时替换
+     * */
+    class LogManager {
+    public:
+        static LogManager* GetInstance();
+
+        // 按名称取logger，不存在时创建(没有appender，等配置或代码添加)
+        Logger::ptr getLogger(const std::string& name);
+
+        // 读取并应用配置文件，失败时输出原因并返回false
+        bool load(const std::string& filename);
+        bool apply(const LogConfig& config, std::string& error);
+
+        /*
+         * 先load一次，然后启动后台线程用inotify监视配置文件，文件写完(IN_CLOSE_WRITE)
+         * 或被替换(IN_MOVED_TO，编辑器和配置下发常用先写临时文件再rename)时重新加载
+         * 监视的是所在目录，文件被删除后重新创建也能继续生效
+         * */
+        bool watch(const std::string& filename);
+        void stopWatch();
+
+        // 成功应用的次数，包括第一次
+        uint64_t getReloadCount() const { return m_reloads.load(std::memory_order_relaxed); }
+
+    private:
+        LogManager() {}
+        ~LogManager();
+        void watchLoop(int inotify_fd, std::string path, std::string name);
+
+    private:
+        std::mutex m_mutex;   // 串行化apply，保护下面两个map
+        std::map<std::string, Logger::ptr> m_loggers;
+        // 当前配置创建的appender，下次apply时定义相同的沿用
+        std::map<std::string, std::pair<LogAppenderDefine, LogAppender::ptr>> m_appenders;
+        std::atomic<uint64_t> m_reloads{0};
+
+        std::mutex m_watchMutex;
+        std::thread m_watchThread;
+        int m_stopFd = -1;   // eventfd，写入后监视线程退出
+    };
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __WEBSERVER_MACRO_H__
+#define __WEBSERVER_MACRO_H__
+
+// 分支预测提示，告诉编译器条件大概率成立/不成立，把冷路径挪到热路径之外
+#if defined(__GNUC__) || defined(__llvm__)
+#   define WEBSERVER_LIKELY(x)     __builtin_expect(!!(x), 1)
+#   define WEBSERVER_UNLIKELY(x)   __builtin_expect(!!(x), 0)
+#else
+#   define WEBSERVER_LIKELY(x)     (x)
+#   define WEBSERVER_UNLIKELY(x)   (x)
+#endif
+
+#endif
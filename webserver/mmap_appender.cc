@@ -0,0 +1,172 @@
+#include "mmap_appender.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <algorithm>
+
+namespace webserver {
+
+    MmapFileLogAppender::MmapFileLogAppender(const std::string& filename, size_t window_size, SyncPolicy policy)
+            : m_filename(filename)
+            , m_policy(policy) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        m_windowSize = (window_size + page - 1) / page * page;
+        if (m_windowSize == 0) {
+            m_windowSize = page;
+        }
+        open();
+    }
+
+    MmapFileLogAppender::~MmapFileLogAppender() {
+        close();
+    }
+
+    bool MmapFileLogAppender::open() {
+        m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0) {
+            std::cout << "MmapFileLogAppender open " << m_filename << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(m_fd, &st) != 0) {
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        // 追加写：窗口从文件末尾所在的页开始
+        size_t size = st.st_size;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t offset = size / page * page;
+        if (!mapWindow(offset)) {
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        m_pos = m_syncPos = size - offset;
+        return true;
+    }
+
+    void MmapFileLogAppender::close() {
+        if (m_fd < 0) {
+            return;
+        }
+        size_t size = m_windowOffset + m_pos;
+        unmapWindow();
+        // 去掉预分配但没有写到的部分
+        if (ftruncate(m_fd, size) != 0) {
+            std::cout << "MmapFileLogAppender truncate " << m_filename << " failed: " << strerror(errno) << std::endl;
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    bool MmapFileLogAppender::mapWindow(size_t offset) {
+        unmapWindow();
+        // 先分配磁盘空间，避免写映射区时因为磁盘满收到SIGBUS
+        int rt = fallocate(m_fd, 0, offset, m_windowSize);
+        if (rt != 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) {
+            rt = ftruncate(m_fd, offset + m_windowSize);   // 文件系统不支持fallocate
+        }
+        if (rt != 0) {
+            std::cout << "MmapFileLogAppender allocate " << m_filename << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        void* addr = mmap(nullptr, m_windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+        if (addr == MAP_FAILED) {
+            std::cout << "MmapFileLogAppender mmap " << m_filename << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        madvise(addr, m_windowSize, MADV_SEQUENTIAL);
+        m_window = (char*)addr;
+        m_windowOffset = offset;
+        m_pos = m_syncPos = 0;
+        return true;
+    }
+
+    void MmapFileLogAppender::unmapWindow() {
+        if (!m_window) {
+            return;
+        }
+        sync(m_window + m_syncPos, m_pos - m_syncPos);
+        if (m_policy == SYNC_SYNC) {
+            madvise(m_window, m_windowSize, MADV_DONTNEED);   // 已经落盘，不再占用page cache
+        }
+        munmap(m_window, m_windowSize);
+        m_window = nullptr;
+    }
+
+    void MmapFileLogAppender::sync(char* addr, size_t len) {
+        if (m_policy == SYNC_NONE || len == 0) {
+            return;
+        }
+        // msync要求起始地址按页对齐
+        size_t page = sysconf(_SC_PAGESIZE);
+        char* begin = m_window + (addr - m_window) / page * page;
+        msync(begin, addr + len - begin, m_policy == SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+    }
+
+    void MmapFileLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+        write(buf.data(), buf.size());
+    }
+
+    void MmapFileLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                           const char* data, size_t len) {
+        write(data, len);
+    }
+
+    void MmapFileLogAppender::write(const char* data, size_t len) {
+        PolicyMutex::Lock lock(m_mutex);
+        while (len > 0 && m_window) {
+            size_t n = std::min(len, m_windowSize - m_pos);
+            memcpy(m_window + m_pos, data, n);
+            m_pos += n;
+            data += n;
+            len -= n;
+            if (m_pos == m_windowSize && !mapWindow(m_windowOffset + m_windowSize)) {
+                break;   // 映射失败，丢弃剩下的内容
+            }
+        }
+    }
+
+    void MmapFileLogAppender::flush() {
+        PolicyMutex::Lock lock(m_mutex);
+        if (m_window) {
+            sync(m_window + m_syncPos, m_pos - m_syncPos);
+            m_syncPos = m_pos;
+        }
+    }
+
+    void MmapFileLogAppender::emergencyFlush() {
+        if (m_fd >= 0) {
+            int rt = ftruncate(m_fd, m_windowOffset + m_pos);
+            (void)rt;
+        }
+    }
+
+    void MmapFileLogAppender::emergencyWrite(const char* data, size_t len) {
+        if (m_fd < 0) {
+            return;
+        }
+        // 用pwrite而不是写映射区：窗口可能放不下，而且Linux上两者共用page cache
+        while (len > 0) {
+            ssize_t n = pwrite(m_fd, data, len, m_windowOffset + m_pos);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data += n;
+            len -= n;
+            m_pos += n;
+        }
+        emergencyFlush();
+    }
+}
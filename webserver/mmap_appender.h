@@ -0,0 +1,68 @@
+#ifndef __WEBSERVER_MMAP_APPENDER_H__
+#define __WEBSERVER_MMAP_APPENDER_H__
+
+#include <string>
+#include "log.h"
+
+namespace webserver {
+
+// 通过内存映射写文件的Appender
+    /*
+     * 预先用fallocate给文件分配一段空间(窗口)并mmap进来，日志直接memcpy到映射区，
+     * 写日志不需要任何系统调用，突发的大量日志由page cache吸收
+     * 当前窗口写满后再映射文件的下一段
+     * 关闭时把文件截断到实际写入的长度
+     * 进程崩溃时已经写进映射区的数据仍然会被内核写回，但文件末尾可能留有预分配的'\0'
+     * */
+    class MmapFileLogAppender : public LogAppender {
+    public:
+        typedef std::shared_ptr<MmapFileLogAppender> ptr;
+
+        // 持久化策略：什么时候调用msync
+        enum SyncPolicy {
+            SYNC_NONE = 0,   // 完全交给内核回写
+            SYNC_ASYNC = 1,  // 换窗口和flush()时 msync(MS_ASYNC)，提前发起回写但不等待
+            SYNC_SYNC = 2,   // 换窗口和flush()时 msync(MS_SYNC) 等待落盘，写完的窗口用madvise释放page cache
+        };
+
+        /*
+         * filename 文件名，已存在时追加写
+         * window_size 每次映射的大小，会向上取整为页大小的整数倍
+         * */
+        MmapFileLogAppender(const std::string& filename, size_t window_size = 16 * 1024 * 1024,
+                            SyncPolicy policy = SYNC_NONE);
+        ~MmapFileLogAppender();
+
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+        void write(const char* data, size_t len) override;
+        void flush() override;
+        // 映射区的内容已经在page cache里，崩溃时只需截掉预分配的部分
+        void emergencyFlush() override;
+        void emergencyWrite(const char* data, size_t len) override;
+
+        // 文件是否成功打开并映射
+        bool isOpen() const { return m_window != nullptr; }
+
+    private:
+        bool open();
+        void close();
+        // 解除当前窗口，映射从offset开始的下一个窗口
+        bool mapWindow(size_t offset);
+        void unmapWindow();
+        void sync(char* addr, size_t len);
+
+    private:
+        std::string m_filename;
+        size_t m_windowSize;
+        SyncPolicy m_policy;
+        int m_fd = -1;
+        char* m_window = nullptr;   // 当前映射的窗口
+        size_t m_windowOffset = 0;  // 窗口在文件中的偏移
+        size_t m_pos = 0;           // 在窗口内已写入的长度
+        size_t m_syncPos = 0;       // 在窗口内已msync到的位置
+    };
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef __WEBSERVER_MUTEX_H__
+#define __WEBSERVER_MUTEX_H__
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+namespace webserver {
+
+// 局部锁：构造时加锁，析构时解锁
+    template<class T>
+    struct ScopedLockImpl {
+    public:
+        ScopedLockImpl(T& mutex)
+            : m_mutex(mutex) {
+            m_mutex.lock();
+            m_locked = true;
+        }
+
+        ~ScopedLockImpl() {
+            unlock();
+        }
+
+        void lock() {
+            if (!m_locked) {
+                m_mutex.lock();
+                m_locked = true;
+            }
+        }
+
+        void unlock() {
+            if (m_locked) {
+                m_mutex.unlock();
+                m_locked = false;
+            }
+        }
+    private:
+        T& m_mutex;
+        bool m_locked;
+    };
+
+// 局部读锁
+    template<class T>
+    struct ReadScopedLockImpl {
+    public:
+        ReadScopedLockImpl(T& mutex)
+            : m_mutex(mutex) {
+            m_mutex.rdlock();
+            m_locked = true;
+        }
+
+        ~ReadScopedLockImpl() {
+            unlock();
+        }
+
+        void unlock() {
+            if (m_locked) {
+                m_mutex.unlock();
+                m_locked = false;
+            }
+        }
+    private:
+        T& m_mutex;
+        bool m_locked;
+    };
+
+// 局部写锁
+    template<class T>
+    struct WriteScopedLockImpl {
+    public:
+        WriteScopedLockImpl(T& mutex)
+            : m_mutex(mutex) {
+            m_mutex.wrlock();
+            m_locked = true;
+        }
+
+        ~WriteScopedLockImpl() {
+            unlock();
+        }
+
+        void unlock() {
+            if (m_locked) {
+                m_mutex.unlock();
+                m_locked = false;
+            }
+        }
+    private:
+        T& m_mutex;
+        bool m_locked;
+    };
+
+// 空锁，单线程使用时零开销
+    class NullMutex {
+    public:
+        typedef ScopedLockImpl<NullMutex> Lock;
+        void lock() {}
+        void unlock() {}
+    };
+
+// 空读写锁
+    class NullRWMutex {
+    public:
+        typedef ReadScopedLockImpl<NullRWMutex> ReadLock;
+        typedef WriteScopedLockImpl<NullRWMutex> WriteLock;
+        void rdlock() {}
+        void wrlock() {}
+        void unlock() {}
+    };
+
+// 互斥量，拿不到锁时线程睡眠，适合临界区里有系统调用的场景
+    class Mutex {
+    public:
+        typedef ScopedLockImpl<Mutex> Lock;
+        Mutex() { pthread_mutex_init(&m_mutex, nullptr); }
+        ~Mutex() { pthread_mutex_destroy(&m_mutex); }
+        Mutex(const Mutex&) = delete;
+        Mutex& operator=(const Mutex&) = delete;
+
+        void lock() { pthread_mutex_lock(&m_mutex); }
+        void unlock() { pthread_mutex_unlock(&m_mutex); }
+    private:
+        pthread_mutex_t m_mutex;
+    };
+
+// 读写锁，读多写少的配置
+    class RWMutex {
+    public:
+        typedef ReadScopedLockImpl<RWMutex> ReadLock;
+        typedef WriteScopedLockImpl<RWMutex> WriteLock;
+        RWMutex() { pthread_rwlock_init(&m_lock, nullptr); }
+        ~RWMutex() { pthread_rwlock_destroy(&m_lock); }
+        RWMutex(const RWMutex&) = delete;
+        RWMutex& operator=(const RWMutex&) = delete;
+
+        void rdlock() { pthread_rwlock_rdlock(&m_lock); }
+        void wrlock() { pthread_rwlock_wrlock(&m_lock); }
+        void unlock() { pthread_rwlock_unlock(&m_lock); }
+    private:
+        pthread_rwlock_t m_lock;
+    };
+
+    static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+// 自旋锁(test-and-test-and-set)
+    /*
+     * 拿不到锁时只读不写地等待，锁所在的cache line在等待者之间保持共享状态，
+     * 释放后才去exchange；等待时指数退避，退避到上限后让出CPU
+     * 适合很短的临界区(比如拷贝一行日志到缓冲区)
+     * */
+    class Spinlock {
+    public:
+        typedef ScopedLockImpl<Spinlock> Lock;
+
+        void lock() {
+            while (m_locked.exchange(true, std::memory_order_acquire)) {
+                uint32_t spins = 1;
+                while (m_locked.load(std::memory_order_relaxed)) {
+                    if (spins <= MAX_SPINS) {
+                        for (uint32_t i = 0; i < spins; ++i) {
+                            CpuRelax();
+                        }
+                        spins <<= 1;
+                    } else {
+                        sched_yield();
+                    }
+                }
+            }
+        }
+
+        void unlock() {
+            m_locked.store(false, std::memory_order_release);
+        }
+    private:
+        static const uint32_t MAX_SPINS = 1024;
+        std::atomic<bool> m_locked{false};
+    };
+
+// 运行时选择的锁
+    /*
+     * 同一个类型按部署选择开销：单线程工具用NONE，短临界区用SPIN，临界区里有IO用MUTEX
+     * lock()里按策略分支，分支在一个对象上总是同一个方向，预测几乎不会失败
+     * 只能在没有线程使用时修改策略
+     * */
+    class PolicyMutex {
+    public:
+        typedef ScopedLockImpl<PolicyMutex> Lock;
+
+        enum Policy {
+            NONE = 0,    // 不加锁
+            SPIN = 1,    // Spinlock
+            MUTEX = 2,   // Mutex
+        };
+
+        PolicyMutex(Policy policy = MUTEX)
+            : m_policy(policy) {
+        }
+
+        void setPolicy(Policy policy) { m_policy = policy; }
+        Policy getPolicy() const { return m_policy; }
+
+        void lock() {
+            if (m_policy == SPIN) {
+                m_spin.lock();
+            } else if (m_policy == MUTEX) {
+                m_mutex.lock();
+            }
+        }
+
+        void unlock() {
+            if (m_policy == SPIN) {
+                m_spin.unlock();
+            } else if (m_policy == MUTEX) {
+                m_mutex.unlock();
+            }
+        }
+
+        static const char* ToString(Policy policy) {
+            switch (policy) {
+                case NONE: return "none";
+                case SPIN: return "spin";
+                case MUTEX: return "mutex";
+            }
+            return "unknown";
+        }
+    private:
+        Policy m_policy;
+        Spinlock m_spin;
+        Mutex m_mutex;
+    };
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __WEBSERVER_NUMFMT_H__
+#define __WEBSERVER_NUMFMT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <charconv>
+
+namespace webserver {
+
+// 数字转文本，直接写进调用者的缓冲区，不经过locale和iostream
+    /*
+     * 整数：先用前导零个数算出位数，从低位往高位每次写两位(查00~99的表)，
+     *       除法是除以常数100，编译器会换成乘法；循环次数只和位数有关，没有逐位的分支
+     * 浮点数：最短的、能原样读回的表示，交给std::to_chars(libstdc++用Ryu实现)
+     * 调用者保证缓冲区足够：整数24字节，浮点数32字节
+     * */
+    namespace numfmt_detail {
+        static const char DIGIT_PAIRS[201] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+
+        static const uint64_t POW10[20] = {
+            1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+            100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+            10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+            100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull};
+    }
+
+    // 十进制位数，0算1位
+    static inline uint32_t DigitCount(uint64_t v) {
+        v |= 1;   // 10的幂都是偶数，或上1不会跨过位数的边界
+        uint32_t bits = 64 - __builtin_clzll(v);
+        uint32_t t = (bits * 1233) >> 12;   // bits * log10(2)，可能多算1位
+        return t + 1 - (v < numfmt_detail::POW10[t]);
+    }
+
+    // 返回写完之后的位置，不写'\0'
+    static inline char* FormatUInt(char* buf, uint64_t v) {
+        char* end = buf + DigitCount(v);
+        char* p = end;
+        while (v >= 100) {
+            uint64_t q = v / 100;
+            uint32_t r = (uint32_t)(v - q * 100);
+            p -= 2;
+            memcpy(p, numfmt_detail::DIGIT_PAIRS + r * 2, 2);
+            v = q;
+        }
+        if (v >= 10) {
+            memcpy(p - 2, numfmt_detail::DIGIT_PAIRS + v * 2, 2);
+        } else {
+            p[-1] = (char)('0' + v);
+        }
+        return end;
+    }
+
+    static inline char* FormatInt(char* buf, int64_t v) {
+        uint64_t u = (uint64_t)v;
+        if (v < 0) {
+            *buf++ = '-';
+            u = 0 - u;   // INT64_MIN 取反也不会溢出
+        }
+        return FormatUInt(buf, u);
+    }
+
+    // 十六进制，不带0x，小写
+    static inline char* FormatHex(char* buf, uint64_t v) {
+        uint32_t n = (64 - __builtin_clzll(v | 1) + 3) / 4;
+        char* end = buf + n;
+        for (char* p = end; p > buf; v >>= 4) {
+            *--p = "0123456789abcdef"[v & 0xf];
+        }
+        return end;
+    }
+
+    // 最短的可以原样读回的表示，和std::to_chars(buf, end, v)相同
+    static inline char* FormatDouble(char* buf, double v) {
+        return std::to_chars(buf, buf + 32, v).ptr;
+    }
+
+    // 按类型选择上面的函数，用于模板代码
+    template<class T>
+    static inline char* FormatNumber(char* buf, T v) {
+        if constexpr (std::is_floating_point<T>::value) {
+            return FormatDouble(buf, v);
+        } else if constexpr (std::is_signed<T>::value) {
+            return FormatInt(buf, v);
+        } else {
+            return FormatUInt(buf, v);
+        }
+    }
+}
+
+#endif
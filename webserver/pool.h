@@ -0,0 +1,190 @@
+#ifndef __WEBSERVER_POOL_H__
+#define __WEBSERVER_POOL_H__
+
+#include <mutex>
+#include <new>
+#include <cstddef>
+
+namespace webserver {
+
+// 定长内存块池
+    /*
+     * 每个线程一条空闲链表，分配/释放都不加锁
+     * 本线程缓存太多时成批还给全局链表，本线程没有空闲块时成批从全局链表取，
+     * 全局链表也空了才一次性向系统申请一批，所以稳定运行后不再调用malloc
+     * 块在一个线程分配、在另一个线程释放(比如异步日志的消费者线程)也没有问题
+     * 申请过的内存不会还给系统
+     * */
+    template<size_t BlockSize>
+    class FixedBlockPool {
+    public:
+        static void* Alloc() {
+            Local& local = t_local;
+            if (local.dead) {
+                return ::operator new(SIZE);   // 线程正在退出，释放时会进全局链表
+            }
+            if (!local.head) {
+                Refill(local);
+            }
+            Node* node = local.head;
+            local.head = node->next;
+            --local.count;
+            return node;
+        }
+
+        static void Free(void* p) {
+            Node* node = static_cast<Node*>(p);
+            Local& local = t_local;
+            if (local.dead) {
+                // 线程正在退出，本线程的缓存已经还回去了，直接放回全局链表
+                Central& central = GetCentral();
+                std::lock_guard<std::mutex> lock(central.mutex);
+                node->next = central.head;
+                central.head = node;
+                ++central.count;
+                return;
+            }
+            if (!local.guard) {
+                RegisterGuard(local);
+            }
+            node->next = local.head;
+            local.head = node;
+            if (++local.count > MAX_LOCAL) {
+                Release(local, BATCH);
+            }
+        }
+
+    private:
+        struct Node {
+            Node* next;
+        };
+
+        // 全局链表，进程内只有一个，故意不析构
+        struct Central {
+            std::mutex mutex;
+            Node* head = nullptr;
+            size_t count = 0;
+        };
+
+        // 线程缓存，必须是平凡析构的，线程退出后还可能被访问
+        struct Local {
+            Node* head = nullptr;
+            size_t count = 0;
+            bool guard = false;
+            bool dead = false;
+        };
+
+        // 线程退出时把本线程缓存还给全局链表
+        struct Guard {
+            ~Guard() {
+                Local& local = t_local;
+                Release(local, local.count);
+                local.dead = true;
+            }
+        };
+
+        static const size_t ALIGN = alignof(std::max_align_t);
+        static const size_t RAW_SIZE = BlockSize < sizeof(Node) ? sizeof(Node) : BlockSize;
+        static const size_t SIZE = (RAW_SIZE + ALIGN - 1) / ALIGN * ALIGN;
+        static const size_t BATCH = 64;             // 线程缓存和全局链表之间每次转移的块数
+        static const size_t MAX_LOCAL = BATCH * 4;  // 线程缓存上限
+
+        static Central& GetCentral() {
+            static Central* s_central = new Central;
+            return *s_central;
+        }
+
+        static void RegisterGuard(Local& local) {
+            static thread_local Guard s_guard;
+            (void)s_guard;
+            local.guard = true;
+        }
+
+        static void Refill(Local& local) {
+            if (!local.guard) {
+                RegisterGuard(local);
+            }
+            Central& central = GetCentral();
+            {
+                std::lock_guard<std::mutex> lock(central.mutex);
+                for (size_t i = 0; i < BATCH && central.head; ++i) {
+                    Node* node = central.head;
+                    central.head = node->next;
+                    --central.count;
+                    node->next = local.head;
+                    local.head = node;
+                    ++local.count;
+                }
+            }
+            if (local.head) {
+                return;
+            }
+            // 一次申请一整批
+            char* chunk = static_cast<char*>(::operator new(SIZE * BATCH));
+            for (size_t i = 0; i < BATCH; ++i) {
+                Node* node = reinterpret_cast<Node*>(chunk + i * SIZE);
+                node->next = local.head;
+                local.head = node;
+            }
+            local.count += BATCH;
+        }
+
+        static void Release(Local& local, size_t n) {
+            if (n == 0) {
+                return;
+            }
+            Central& central = GetCentral();
+            std::lock_guard<std::mutex> lock(central.mutex);
+            for (size_t i = 0; i < n && local.head; ++i) {
+                Node* node = local.head;
+                local.head = node->next;
+                --local.count;
+                node->next = central.head;
+                central.head = node;
+                ++central.count;
+            }
+        }
+
+        static thread_local Local t_local;
+    };
+
+    template<size_t BlockSize>
+    thread_local typename FixedBlockPool<BlockSize>::Local FixedBlockPool<BlockSize>::t_local;
+
+    /*
+     * 从FixedBlockPool分配的分配器
+     * 配合 std::allocate_shared 使用，对象和shared_ptr的控制块在同一块池化内存里
+     * */
+    template<class T>
+    class PoolAllocator {
+    public:
+        typedef T value_type;
+
+        PoolAllocator() = default;
+        template<class U>
+        PoolAllocator(const PoolAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+            if (n == 1) {
+                return static_cast<T*>(FixedBlockPool<sizeof(T)>::Alloc());
+            }
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n) {
+            if (n == 1) {
+                FixedBlockPool<sizeof(T)>::Free(p);
+                return;
+            }
+            ::operator delete(p);
+        }
+
+        template<class U>
+        bool operator==(const PoolAllocator<U>&) const { return true; }
+        template<class U>
+        bool operator!=(const PoolAllocator<U>&) const { return false; }
+    };
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include "ratelimit.h"
+#include "log.h"
+#include <time.h>
+#include <chrono>
+
+namespace webserver {
+
+    LogRateLimit LogRateLimit::TokenBucket(double rate, uint32_t burst) {
+        LogRateLimit limit;
+        limit.type = TOKEN_BUCKET;
+        limit.rate = rate;
+        limit.burst = burst ? burst : 1;
+        return limit;
+    }
+
+    LogRateLimit LogRateLimit::Sample(uint32_t n) {
+        LogRateLimit limit;
+        limit.type = SAMPLE;
+        limit.n = n ? n : 1;
+        return limit;
+    }
+
+    LogRateLimit LogRateLimit::FirstNEveryM(uint32_t n, uint32_t m) {
+        LogRateLimit limit;
+        limit.type = FIRST_N_EVERY_M;
+        limit.n = n;
+        limit.m = m ? m : 1;
+        return limit;
+    }
+
+    static uint64_t MonotonicNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    LogSite::LogSite(const char* file, int32_t line)
+        : m_file(file)
+        , m_line(line) {
+        LogRateLimiter::GetInstance()->registerSite(this);
+    }
+
+    void LogSite::setLimit(const LogRateLimit& limit) {
+        // 之后进来的读者在参数改完之前都走NONE，不会按旧类型解释新参数
+        m_type.store(LogRateLimit::NONE, std::memory_order_release);
+        m_n.store(limit.n, std::memory_order_relaxed);
+        m_m.store(limit.m, std::memory_order_relaxed);
+        uint64_t interval = limit.rate > 0 ? (uint64_t)(1e9 / limit.rate) : 0;
+        m_intervalNs.store(interval, std::memory_order_relaxed);
+        m_burstNs.store(interval * (limit.burst ? limit.burst - 1 : 0), std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+        m_tat.store(0, std::memory_order_relaxed);
+        m_type.store(limit.type, std::memory_order_release);
+    }
+
+    bool LogSite::allowSlow() {
+        bool ok = true;
+        switch (m_type.load(std::memory_order_acquire)) {
+            case LogRateLimit::TOKEN_BUCKET: {
+                /*
+                 * GCRA，与令牌桶等价，但状态只有一个"理论到达时间"，一次CAS即可更新
+                 * 新的tat = max(tat, now) + interval，超出now + burst就拒绝
+                 * */
+                uint64_t interval = m_intervalNs.load(std::memory_order_relaxed);
+                uint64_t burst = m_burstNs.load(std::memory_order_relaxed);
+                uint64_t now = MonotonicNs();
+                uint64_t tat = m_tat.load(std::memory_order_relaxed);
+                while (true) {
+                    uint64_t next = (tat > now ? tat : now) + interval;
+                    if (next - now > burst + interval) {
+                        ok = false;
+                        break;
+                    }
+                    if (m_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                break;
+            }
+            case LogRateLimit::SAMPLE: {
+                uint64_t c = m_count.fetch_add(1, std::memory_order_relaxed);
+                uint64_t n = m_n.load(std::memory_order_relaxed);   // 可能刚被改成FIRST_N_EVERY_M的n(可以为0)
+                ok = c % (n ? n : 1) == 0;
+                break;
+            }
+            case LogRateLimit::FIRST_N_EVERY_M: {
+                uint64_t c = m_count.fetch_add(1, std::memory_order_relaxed);
+                uint64_t n = m_n.load(std::memory_order_relaxed);
+                uint64_t m = m_m.load(std::memory_order_relaxed);
+                ok = c < n || (c - n + 1) % (m ? m : 1) == 0;
+                break;
+            }
+            default:
+                break;
+        }
+        if (!ok) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        }
+        return ok;
+    }
+
+    LogRateLimiter* LogRateLimiter::GetInstance() {
+        // 调用点是静态变量，析构顺序不确定，限流器不释放
+        static LogRateLimiter* s_instance = new LogRateLimiter;
+        return s_instance;
+    }
+
+    LogRateLimiter::~LogRateLimiter() {
+        stopReport();
+    }
+
+    // site 形如 "dir/file.cc:123"，key 可以只写路径的后缀 "file.cc:123"
+    static bool MatchSite(const LogSite* site, const std::string& key) {
+        size_t colon = key.rfind(':');
+        if (colon == std::string::npos || std::to_string(site->getLine()) != key.substr(colon + 1)) {
+            return false;
+        }
+        std::string file = site->getFile();
+        size_t len = colon;
+        if (len > file.size() || file.compare(file.size() - len, len, key, 0, len) != 0) {
+            return false;
+        }
+        return len == file.size() || file[file.size() - len - 1] == '/';
+    }
+
+    const LogRateLimit* LogRateLimiter::findLimit(const LogSite* site) const {
+        for (auto& i : m_limits) {
+            if (MatchSite(site, i.first)) {
+                return &i.second;
+            }
+        }
+        return &m_default;
+    }
+
+    void LogRateLimiter::registerSite(LogSite* site) {
+        // 查配置和插入链表在同一个锁里，setLimit要么在之前(这里查到新配置)，要么在之后(遍历时能看到这个调用点)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const LogRateLimit* limit = findLimit(site);
+        if (limit->type != LogRateLimit::NONE) {
+            site->setLimit(*limit);
+        }
+        site->m_next = m_sites.load(std::memory_order_relaxed);
+        m_sites.store(site, std::memory_order_release);
+    }
+
+    void LogRateLimiter::setLimit(const std::string& key, const LogRateLimit& limit) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_limits[key] = limit;
+        for (LogSite* site = m_sites.load(std::memory_order_acquire); site; site = site->m_next) {
+            if (MatchSite(site, key)) {
+                site->setLimit(limit);
+            }
+        }
+    }
+
+    void LogRateLimiter::setDefaultLimit(const LogRateLimit& limit) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_default = limit;
+        for (LogSite* site = m_sites.load(std::memory_order_acquire); site; site = site->m_next) {
+            if (findLimit(site) == &m_default) {
+                site->setLimit(limit);
+            }
+        }
+    }
+
+    void LogRateLimiter::report(std::shared_ptr<Logger> logger) {
+        uint64_t total = 0;
+        LogStream ss;
+        for (LogSite* site = m_sites.load(std::memory_order_acquire); site; site = site->m_next) {
+            uint64_t n = site->takeSuppressed();
+            if (n) {
+                ss << (total ? ", " : "") << site->getFile() << ":" << site->getLine() << "=" << n;
+                total += n;
+            }
+        }
+        if (total) {
+            // 直接交给logger，不经过宏，汇总行本身不受限流影响
+            LogEventWrap wrap(logger.get(), LogLevel::WARN, __FILE__, __LINE__);
+            wrap.getSS() << "rate limit suppressed " << total << " log events: " << ss.view();
+        }
+    }
+
+    void LogRateLimiter::startReport(std::shared_ptr<Logger> logger, int interval_ms) {
+        stopReport();
+        std::lock_guard<std::mutex> lock(m_reportMutex);
+        m_reporting = true;
+        m_reportThread = std::thread([this, logger, interval_ms]() {
+            SetThreadName("log_ratelimit");
+            std::unique_lock<std::mutex> lock(m_reportMutex);
+            while (m_reporting) {
+                m_reportCond.wait_for(lock, std::chrono::milliseconds(interval_ms));
+                lock.unlock();
+                report(logger);
+                lock.lock();
+            }
+        });
+    }
+
+    void LogRateLimiter::stopReport() {
+        {
+            std::lock_guard<std::mutex> lock(m_reportMutex);
+            if (!m_reporting) {
+                return;
+            }
+            m_reporting = false;
+        }
+        m_reportCond.notify_all();
+        m_reportThread.join();
+    }
+}
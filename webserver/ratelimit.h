@@ -0,0 +1,127 @@
+#ifndef __WEBSERVER_RATELIMIT_H__
+#define __WEBSERVER_RATELIMIT_H__
+
+#include <atomic>
+#include <string>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+#include "macro.h"
+
+namespace webserver {
+    class Logger;
+
+// 一个调用点的限流策略
+    struct LogRateLimit {
+        enum Type {
+            NONE = 0,             // 不限制
+            TOKEN_BUCKET = 1,     // 令牌桶：平均每秒rate条，最多突发burst条
+            SAMPLE = 2,           // 每n条记一条
+            FIRST_N_EVERY_M = 3,  // 前n条都记，之后每m条记一条
+        };
+        Type type = NONE;
+        double rate = 0;
+        uint32_t burst = 1;
+        uint32_t n = 1;
+        uint32_t m = 1;
+
+        static LogRateLimit TokenBucket(double rate, uint32_t burst);
+        static LogRateLimit Sample(uint32_t n);
+        static LogRateLimit FirstNEveryM(uint32_t n, uint32_t m);
+    };
+
+// 日志调用点，每个日志宏展开处有一个静态实例
+    /*
+     * 以 文件名:行号 标识，第一次执行时注册到LogRateLimiter
+     * allow() 在创建事件之前调用，被拒绝的日志不会做任何格式化
+     * 判断只用本调用点自己的原子计数器，不加锁；没有配置限流时只有一次load
+     * */
+    class LogSite {
+    public:
+        LogSite(const char* file, int32_t line);
+
+        bool allow() {
+            if (WEBSERVER_LIKELY(m_type.load(std::memory_order_relaxed) == LogRateLimit::NONE)) {
+                return true;
+            }
+            return allowSlow();
+        }
+
+        const char* getFile() const { return m_file; }
+        int32_t getLine() const { return m_line; }
+
+        void setLimit(const LogRateLimit& limit);
+        // 取出并清零自上次以来被丢弃的条数
+        uint64_t takeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+    private:
+        bool allowSlow();
+
+    private:
+        friend class LogRateLimiter;
+        const char* m_file;
+        int32_t m_line;
+        LogSite* m_next = nullptr;   // 所有调用点串成单链表，只增不减
+
+        /*
+         * 策略拆成各自的原子变量，修改时不用加锁：先把m_type设为NONE再改参数，最后发布新的m_type
+         * 已经进入旧分支的读者仍可能读到新参数，只影响一两条日志，除数按不小于1处理
+         * */
+        std::atomic<int> m_type{LogRateLimit::NONE};
+        std::atomic<uint32_t> m_n{1};
+        std::atomic<uint32_t> m_m{1};
+        std::atomic<uint64_t> m_intervalNs{0};   // 令牌桶：产生一个令牌的间隔
+        std::atomic<uint64_t> m_burstNs{0};      // 令牌桶：允许提前的时间(burst个间隔)
+
+        std::atomic<uint64_t> m_count{0};        // SAMPLE/FIRST_N_EVERY_M 的计数
+        std::atomic<uint64_t> m_tat{0};          // 令牌桶：理论到达时间(GCRA)
+        std::atomic<uint64_t> m_suppressed{0};
+    };
+
+// 调用点的限流配置与丢弃统计
+    /*
+     * setLimit("file.cc:123", limit) 按 文件名:行号 配置，文件名匹配路径的后缀，
+     * 之后才第一次执行的调用点在注册时应用配置
+     * setDefaultLimit 作用于没有单独配置的调用点
+     * startReport 启动后台线程，定期把各调用点丢弃的条数汇总成一行日志
+     * */
+    class LogRateLimiter {
+    public:
+        static LogRateLimiter* GetInstance();
+
+        void setLimit(const std::string& site, const LogRateLimit& limit);
+        void setDefaultLimit(const LogRateLimit& limit);
+
+        // 把自上次以来的丢弃条数写成一条WARN日志，没有丢弃时不输出
+        void report(std::shared_ptr<Logger> logger);
+        void startReport(std::shared_ptr<Logger> logger, int interval_ms = 60000);
+        void stopReport();
+
+        void registerSite(LogSite* site);
+
+    private:
+        LogRateLimiter() {}
+        ~LogRateLimiter();
+        const LogRateLimit* findLimit(const LogSite* site) const;
+
+    private:
+        std::atomic<LogSite*> m_sites{nullptr};   // 在m_mutex下插入，report不加锁遍历
+        std::mutex m_mutex;   // 保护配置和m_sites的插入
+        std::map<std::string, LogRateLimit> m_limits;
+        LogRateLimit m_default;
+
+        std::mutex m_reportMutex;
+        std::condition_variable m_reportCond;
+        std::thread m_reportThread;
+        bool m_reporting = false;
+    };
+}
+
+// 当前调用点是否允许输出，每个展开处有自己的静态LogSite
+#define WEBSERVER_LOG_SITE_ALLOW() \
+    ([]() -> webserver::LogSite& { static webserver::LogSite s_site(__FILE__, __LINE__); return s_site; }().allow())
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __WEBSERVER_RING_BUFFER_H__
+#define __WEBSERVER_RING_BUFFER_H__
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace webserver {
+
+    static const size_t CACHE_LINE_SIZE = 64;
+
+// 有界 多生产者/单消费者 环形队列
+    /*
+     * 参考 Dmitry Vyukov 的 bounded MPMC queue，消费者只有一个，所以出队不需要CAS
+     * 每个槽位带一个序号：
+     *   seq == pos      槽位空闲，生产者可以写
+     *   seq == pos + 1  槽位已写好，消费者可以读
+     * 生产者之间只竞争 m_enqueuePos 一个计数器，没有互斥锁
+     * 两个位置计数器各占一条cache line，避免生产者和消费者伪共享
+     * */
+    template<class T>
+    class MpscRingBuffer {
+    public:
+        // capacity 会向上取整为2的幂
+        explicit MpscRingBuffer(size_t capacity)
+            : m_enqueuePos(0)
+            , m_dequeuePos(0) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            m_mask = size - 1;
+            m_buffer.reset(new Cell[size]);
+            for (size_t i = 0; i < size; ++i) {
+                m_buffer[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRingBuffer(const MpscRingBuffer&) = delete;
+        MpscRingBuffer& operator=(const MpscRingBuffer&) = delete;
+
+        /*
+         * 生产者入队，队列满返回false
+         * 只有成功时才会move走val
+         * */
+        bool tryPush(T& val) {
+            Cell* cell;
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &m_buffer[pos & m_mask];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if (dif == 0) {
+                    // 槽位空闲，抢占这个位置
+                    if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (dif < 0) {
+                    return false;   // 消费者还没读走，队列满
+                } else {
+                    pos = m_enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = std::move(val);
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // 消费者出队，只允许一个线程调用，队列空返回false
+        bool tryPop(T& val) {
+            size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+            Cell* cell = &m_buffer[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+                return false;
+            }
+            val = std::move(cell->data);
+            cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+            m_dequeuePos.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+         * 按顺序访问还没出队的元素，不出队
+         * 只在崩溃时使用，调用前要让消费者停住(见CrashHandler)，否则出队会让遍历提前结束
+         * 遇到生产者还没写完的槽位就停止
+         * */
+        template<class F>
+        void peek(F f) const {
+            for (size_t pos = m_dequeuePos.load(std::memory_order_acquire); ; ++pos) {
+                const Cell& cell = m_buffer[pos & m_mask];
+                if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+                    break;
+                }
+                f(cell.data);
+            }
+        }
+
+        size_t capacity() const { return m_mask + 1; }
+
+        // 到目前为止生产者占用过的位置数，用于flush时判断消费者是否追上
+        size_t enqueueCount() const { return m_enqueuePos.load(std::memory_order_acquire); }
+
+    private:
+        struct alignas(CACHE_LINE_SIZE) Cell {
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueuePos;   // 生产者共享
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeuePos;   // 只有消费者修改，崩溃时peek读
+        alignas(CACHE_LINE_SIZE) size_t m_mask;
+        std::unique_ptr<Cell[]> m_buffer;
+    };
+}
+
+#endif
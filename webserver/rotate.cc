@@ -0,0 +1,237 @@
+#include "rotate.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace webserver {
+
+    LogRotator* LogRotator::GetInstance() {
+        static LogRotator s_instance;
+        return &s_instance;
+    }
+
+    LogRotator::LogRotator() {
+        m_thread = std::thread(&LogRotator::run, this);
+    }
+
+    LogRotator::~LogRotator() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_one();
+        m_thread.join();   // 没处理完的任务留给下次切分时的目录扫描
+    }
+
+    void LogRotator::schedule(const std::string& filename, const FileLogAppender::RotatePolicy& policy) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& task : m_tasks) {
+                if (task.filename == filename) {   // 同一个文件的任务还在排队，合并
+                    task.policy = policy;
+                    return;
+                }
+            }
+            Task task;
+            task.filename = filename;
+            task.policy = policy;
+            m_tasks.push_back(task);
+        }
+        m_cond.notify_one();
+    }
+
+    void LogRotator::run() {
+        SetThreadName("log_rotate");
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+                if (m_stop) {
+                    return;
+                }
+                task = m_tasks.front();
+                m_tasks.pop_front();
+            }
+            Process(task.filename, task.policy);
+        }
+    }
+
+    // 切分出来的一个文件
+    struct RotatedFile {
+        std::string path;
+        std::string stamp;   // YYYYMMDD-HH
+        int seq = 0;         // 同一小时内的序号
+        bool gz = false;
+        uint64_t size = 0;
+    };
+
+    // 判断name是否是 base.YYYYMMDD-HH.N[.gz]
+    static bool ParseRotatedName(const std::string& name, const std::string& base, RotatedFile& file) {
+        if (name.size() <= base.size() + 1 || name.compare(0, base.size(), base) != 0
+                || name[base.size()] != '.') {
+            return false;
+        }
+        std::string rest = name.substr(base.size() + 1);
+        if (rest.size() < 13 || rest[8] != '-' || rest[11] != '.') {
+            return false;
+        }
+        for (int i = 0; i < 11; ++i) {
+            if (i != 8 && !isdigit(rest[i])) {
+                return false;
+            }
+        }
+        std::string seq = rest.substr(12);
+        if (seq.size() > 3 && seq.compare(seq.size() - 3, 3, ".gz") == 0) {
+            file.gz = true;
+            seq = seq.substr(0, seq.size() - 3);
+        }
+        if (seq.empty() || seq.size() > 9 || !std::all_of(seq.begin(), seq.end(), ::isdigit)) {
+            return false;
+        }
+        file.stamp = rest.substr(0, 11);
+        file.seq = atoi(seq.c_str());
+        return true;
+    }
+
+    // 把filename拆成所在目录和文件名
+    static void SplitPath(const std::string& filename, std::string& dir, std::string& base) {
+        dir = ".";
+        base = filename;
+        size_t pos = filename.rfind('/');
+        if (pos != std::string::npos) {
+            dir = pos == 0 ? "/" : filename.substr(0, pos);
+            base = filename.substr(pos + 1);
+        }
+    }
+
+    static bool FileExists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0;
+    }
+
+    std::string LogRotator::MakeRotatedName(const std::string& filename, time_t open_time,
+                                            std::string& stamp, int& seq) {
+        struct tm tm;
+        localtime_r(&open_time, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y%m%d-%H", &tm);
+        if (stamp != buf) {
+            // 这一小时的第一次切分，接在目录里已有的序号之后(比如进程重启前切分出来的)
+            stamp = buf;
+            seq = 0;
+            std::string dir, base;
+            SplitPath(filename, dir, base);
+            if (DIR* d = opendir(dir.c_str())) {
+                while (struct dirent* ent = readdir(d)) {
+                    RotatedFile file;
+                    if (ParseRotatedName(ent->d_name, base, file) && file.stamp == stamp && file.seq >= seq) {
+                        seq = file.seq + 1;
+                    }
+                }
+                closedir(d);
+            }
+        }
+        std::string prefix = filename + "." + stamp + ".";
+        std::string name = prefix + std::to_string(seq++);
+        // 别的进程也在切分同一个文件时才会占用，一般只检查一次
+        while (FileExists(name) || FileExists(name + ".gz")) {
+            name = prefix + std::to_string(seq++);
+        }
+        return name;
+    }
+
+    // 压缩成path.gz，先写临时文件再改名，中途失败不会留下半个.gz
+    static bool GzipFile(const std::string& path) {
+        FILE* in = fopen(path.c_str(), "rb");
+        if (!in) {
+            return false;
+        }
+        std::string tmp = path + ".gz.tmp";
+        gzFile out = gzopen(tmp.c_str(), "wb");
+        if (!out) {
+            fclose(in);
+            return false;
+        }
+        std::vector<char> buf(64 * 1024);
+        bool ok = true;
+        size_t n;
+        while ((n = fread(buf.data(), 1, buf.size(), in)) > 0) {
+            if (gzwrite(out, buf.data(), n) != (int)n) {
+                ok = false;
+                break;
+            }
+        }
+        ok = ok && !ferror(in);
+        fclose(in);
+        ok = gzclose(out) == Z_OK && ok;
+        if (!ok || rename(tmp.c_str(), (path + ".gz").c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        unlink(path.c_str());
+        return true;
+    }
+
+    void LogRotator::Process(const std::string& filename, const FileLogAppender::RotatePolicy& policy) {
+        std::string dir, base;
+        SplitPath(filename, dir, base);
+
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            return;
+        }
+        std::vector<RotatedFile> files;
+        while (struct dirent* ent = readdir(d)) {
+            RotatedFile file;
+            if (!ParseRotatedName(ent->d_name, base, file)) {
+                continue;
+            }
+            file.path = dir + "/" + ent->d_name;
+            files.push_back(file);
+        }
+        closedir(d);
+
+        for (auto& file : files) {
+            if (policy.compress && !file.gz) {
+                if (GzipFile(file.path)) {
+                    file.path += ".gz";
+                    file.gz = true;
+                } else {
+                    std::cout << "LogRotator compress " << file.path << " failed" << std::endl;
+                }
+            }
+            struct stat st;
+            if (stat(file.path.c_str(), &st) == 0) {
+                file.size = st.st_size;
+            }
+        }
+
+        // 从旧到新排序，超出保留个数或总大小时删除最旧的
+        std::sort(files.begin(), files.end(), [](const RotatedFile& a, const RotatedFile& b) {
+            return a.stamp != b.stamp ? a.stamp < b.stamp : a.seq < b.seq;
+        });
+        uint64_t total = 0;
+        for (auto& file : files) {
+            total += file.size;
+        }
+        size_t count = files.size();
+        for (auto& file : files) {
+            bool too_many = policy.max_files && count > policy.max_files;
+            bool too_large = policy.max_total_size && total > policy.max_total_size;
+            if (!too_many && !too_large) {
+                break;
+            }
+            if (unlink(file.path.c_str()) == 0) {
+                --count;
+                total -= file.size;
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef __WEBSERVER_ROTATE_H__
+#define __WEBSERVER_ROTATE_H__
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <time.h>
+#include "log.h"
+
+namespace webserver {
+
+// 日志切分的后台处理
+    /*
+     * FileLogAppender 切分后把任务交给这里，由一个后台线程：
+     *   1. 把切分出来的文件 gzip 压缩成 name.YYYYMMDD-HH.N.gz
+     *   2. 按保留个数/总大小删除最旧的文件
+     * 每次处理都会扫描目录，上次没来得及压缩的文件(比如进程退出)也会一起处理
+     * */
+    class LogRotator {
+    public:
+        static LogRotator* GetInstance();
+
+        /*
+         * 切分后的文件名 filename.YYYYMMDD-HH.N
+         * stamp/seq 由调用者保存：进入新的一小时时扫描一次目录，从已有的最大序号之后开始，
+         * 同一小时内之后的切分直接递增，不用逐个序号stat
+         * */
+        static std::string MakeRotatedName(const std::string& filename, time_t open_time,
+                                           std::string& stamp, int& seq);
+
+        // 提交一个处理任务，不阻塞
+        void schedule(const std::string& filename, const FileLogAppender::RotatePolicy& policy);
+
+        // 同步处理，不经过后台线程
+        static void Process(const std::string& filename, const FileLogAppender::RotatePolicy& policy);
+
+    private:
+        LogRotator();
+        ~LogRotator();
+        void run();
+
+    private:
+        struct Task {
+            std::string filename;
+            FileLogAppender::RotatePolicy policy;
+        };
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::list<Task> m_tasks;
+        bool m_stop = false;
+        std::thread m_thread;
+    };
+}
+
+#endif
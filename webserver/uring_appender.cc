@@ -0,0 +1,400 @@
+#include "uring_appender.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <iostream>
+#include <algorithm>
+
+namespace webserver {
+
+    // fdatasync请求的user_data，写请求用缓冲区下标
+    static const uint64_t SYNC_USER_DATA = ~0ull;
+
+    // 映射到用户态的提交队列和完成队列
+    struct IoUring {
+        int fd = -1;
+        void* sqPtr = MAP_FAILED;
+        size_t sqSize = 0;
+        void* cqPtr = MAP_FAILED;
+        size_t cqSize = 0;
+        io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+        size_t sqesSize = 0;
+
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        io_uring_cqe* cqes = nullptr;
+
+        unsigned pending = 0;   // 已放进提交队列但还没有被内核取走的请求数
+
+        int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+            int rt;
+            do {
+                rt = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+            } while (rt < 0 && errno == EINTR);
+            return rt;
+        }
+
+        int registerOp(unsigned opcode, void* arg, unsigned nr) {
+            return syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+        }
+
+        io_uring_sqe* getSqe() {
+            unsigned tail = *sqTail;
+            if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqMask + 1) {
+                return nullptr;
+            }
+            unsigned idx = tail & *sqMask;
+            sqArray[idx] = idx;
+            io_uring_sqe* sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            ++pending;
+            return sqe;
+        }
+    };
+
+    IoUringFileLogAppender::IoUringFileLogAppender(const std::string& filename, size_t buffer_size,
+                                                   size_t buffer_count, bool sync)
+            : m_filename(filename)
+            , m_sync(sync) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        m_bufferSize = std::max((buffer_size + page - 1) / page * page, page);
+        m_buffers.resize(std::max<size_t>(buffer_count, 1));
+
+        m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0) {
+            std::cout << "IoUringFileLogAppender open " << m_filename << " failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        struct stat st;
+        if (fstat(m_fd, &st) == 0) {
+            m_offset = st.st_size;   // 追加写
+        }
+        for (auto& buf : m_buffers) {
+            void* p = nullptr;
+            if (posix_memalign(&p, page, m_bufferSize) != 0) {
+                std::cout << "IoUringFileLogAppender alloc buffer failed" << std::endl;
+                ::close(m_fd);
+                m_fd = -1;
+                return;
+            }
+            buf.data = (char*)p;
+        }
+        if (!setupRing()) {
+            closeRing();
+        }
+    }
+
+    IoUringFileLogAppender::~IoUringFileLogAppender() {
+        if (m_fd >= 0) {
+            flush();
+            closeRing();
+            ::close(m_fd);
+        }
+        for (auto& buf : m_buffers) {
+            free(buf.data);
+        }
+    }
+
+    bool IoUringFileLogAppender::setupRing() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        // 每个缓冲区最多同时有一个写请求和一个fdatasync在途
+        int fd = syscall(__NR_io_uring_setup, (unsigned)m_buffers.size() * 2, &params);
+        if (fd < 0) {
+            std::cout << "IoUringFileLogAppender io_uring unavailable(" << strerror(errno)
+                      << "), fallback to pwritev" << std::endl;
+            return false;
+        }
+        m_ring = new IoUring;
+        IoUring& ring = *m_ring;
+        ring.fd = fd;
+
+        ring.sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring.cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            ring.sqSize = ring.cqSize = std::max(ring.sqSize, ring.cqSize);
+        }
+        ring.sqPtr = mmap(nullptr, ring.sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQ_RING);
+        if (ring.sqPtr == MAP_FAILED) {
+            return false;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            ring.cqPtr = ring.sqPtr;
+        } else {
+            ring.cqPtr = mmap(nullptr, ring.cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              fd, IORING_OFF_CQ_RING);
+            if (ring.cqPtr == MAP_FAILED) {
+                return false;
+            }
+        }
+        ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        ring.sqes = (io_uring_sqe*)mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (ring.sqes == MAP_FAILED) {
+            return false;
+        }
+
+        char* sq = (char*)ring.sqPtr;
+        ring.sqHead = (unsigned*)(sq + params.sq_off.head);
+        ring.sqTail = (unsigned*)(sq + params.sq_off.tail);
+        ring.sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        ring.sqArray = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)ring.cqPtr;
+        ring.cqHead = (unsigned*)(cq + params.cq_off.head);
+        ring.cqTail = (unsigned*)(cq + params.cq_off.tail);
+        ring.cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        ring.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // 注册失败(比如RLIMIT_MEMLOCK不够)不影响使用，只是退回普通的写请求
+        std::vector<iovec> iovs(m_buffers.size());
+        for (size_t i = 0; i < m_buffers.size(); ++i) {
+            iovs[i].iov_base = m_buffers[i].data;
+            iovs[i].iov_len = m_bufferSize;
+        }
+        m_fixedBuffers = ring.registerOp(IORING_REGISTER_BUFFERS, iovs.data(), iovs.size()) == 0;
+        m_fixedFile = ring.registerOp(IORING_REGISTER_FILES, &m_fd, 1) == 0;
+        return true;
+    }
+
+    void IoUringFileLogAppender::closeRing() {
+        if (!m_ring) {
+            return;
+        }
+        IoUring& ring = *m_ring;
+        if (ring.sqes != MAP_FAILED) {
+            munmap(ring.sqes, ring.sqesSize);
+        }
+        if (ring.cqPtr != MAP_FAILED && ring.cqPtr != ring.sqPtr) {
+            munmap(ring.cqPtr, ring.cqSize);
+        }
+        if (ring.sqPtr != MAP_FAILED) {
+            munmap(ring.sqPtr, ring.sqSize);
+        }
+        ::close(ring.fd);   // 关闭时内核会注销已注册的缓冲区和fd
+        delete m_ring;
+        m_ring = nullptr;
+        m_fixedBuffers = m_fixedFile = false;
+    }
+
+    void IoUringFileLogAppender::log(const Logger& logger, LogLevel::Level level, const LogEvent& event) {
+        static thread_local std::string buf;
+        buf.clear();
+        m_formatter->format(buf, logger, level, event);
+        write(buf.data(), buf.size());
+    }
+
+    void IoUringFileLogAppender::logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                                              const char* data, size_t len) {
+        write(data, len);
+    }
+
+    void IoUringFileLogAppender::write(const char* data, size_t len) {
+        PolicyMutex::Lock lock(m_mutex);
+        if (m_fd < 0) {
+            return;
+        }
+        while (len > 0) {
+            if (m_current < 0) {
+                m_current = acquireBuffer();
+            }
+            Buffer& buf = m_buffers[m_current];
+            size_t n = std::min(len, m_bufferSize - buf.len);
+            memcpy(buf.data + buf.len, data, n);
+            buf.len += n;
+            data += n;
+            len -= n;
+            if (buf.len == m_bufferSize) {
+                submitBuffer(m_current);
+                m_current = -1;
+            }
+        }
+    }
+
+    void IoUringFileLogAppender::flush() {
+        PolicyMutex::Lock lock(m_mutex);
+        if (m_fd < 0) {
+            return;
+        }
+        if (m_current >= 0 && m_buffers[m_current].len > 0) {
+            submitBuffer(m_current);
+            m_current = -1;
+        }
+        while (m_inflight > 0) {
+            reap(true);
+        }
+    }
+
+    int IoUringFileLogAppender::acquireBuffer() {
+        while (true) {
+            for (size_t i = 0; i < m_buffers.size(); ++i) {
+                if (!m_buffers[i].busy) {
+                    return i;
+                }
+            }
+            reap(true);
+        }
+    }
+
+    void IoUringFileLogAppender::submitBuffer(int idx) {
+        Buffer& buf = m_buffers[idx];
+        buf.offset = m_offset;
+        m_offset += buf.len;
+
+        if (!m_ring) {
+            writeSync(buf.data, buf.len, buf.offset);
+            if (m_sync) {
+                fdatasync(m_fd);
+            }
+            buf.len = 0;
+            return;
+        }
+
+        io_uring_sqe* sqe = m_ring->getSqe();
+        while (!sqe) {   // 提交队列按缓冲区个数的两倍申请，正常不会满
+            reap(true);
+            sqe = m_ring->getSqe();
+        }
+        sqe->opcode = m_fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = m_fixedFile ? 0 : m_fd;
+        sqe->flags = m_fixedFile ? IOSQE_FIXED_FILE : 0;
+        sqe->addr = (uintptr_t)buf.data;
+        sqe->len = buf.len;
+        sqe->off = buf.offset;
+        sqe->buf_index = m_fixedBuffers ? idx : 0;
+        sqe->user_data = idx;
+        buf.busy = true;
+        ++m_inflight;
+
+        if (m_sync) {
+            // 链接在写请求之后，写成功才会执行
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* fsync = m_ring->getSqe();
+            while (!fsync) {
+                reap(true);
+                fsync = m_ring->getSqe();
+            }
+            fsync->opcode = IORING_OP_FSYNC;
+            fsync->fd = m_fixedFile ? 0 : m_fd;
+            fsync->flags = m_fixedFile ? IOSQE_FIXED_FILE : 0;
+            fsync->fsync_flags = IORING_FSYNC_DATASYNC;
+            fsync->user_data = SYNC_USER_DATA;
+            ++m_inflight;
+        }
+        reap(false);
+    }
+
+    void IoUringFileLogAppender::reap(bool wait) {
+        IoUring& ring = *m_ring;
+        if (wait || ring.pending > 0) {
+            int rt = ring.enter(ring.pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+            if (rt >= 0) {
+                ring.pending -= std::min<unsigned>(rt, ring.pending);
+            } else if (errno != EAGAIN && errno != EBUSY) {
+                std::cout << "IoUringFileLogAppender io_uring_enter failed: " << strerror(errno) << std::endl;
+            }
+        }
+
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+            --m_inflight;
+            if (cqe->user_data == SYNC_USER_DATA) {
+                // 写请求失败时链接的fdatasync会被取消
+                if (cqe->res < 0 && cqe->res != -ECANCELED) {
+                    std::cout << "IoUringFileLogAppender fdatasync failed: " << strerror(-cqe->res) << std::endl;
+                }
+                continue;
+            }
+            Buffer& buf = m_buffers[cqe->user_data];
+            if (cqe->res < (int)buf.len) {
+                // 出错或短写，剩下的部分同步补写
+                size_t done = cqe->res > 0 ? cqe->res : 0;
+                if (cqe->res < 0) {
+                    std::cout << "IoUringFileLogAppender write failed: " << strerror(-cqe->res) << std::endl;
+                }
+                writeSync(buf.data + done, buf.len - done, buf.offset + done);
+            }
+            buf.len = 0;
+            buf.busy = false;
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void IoUringFileLogAppender::writeSync(const char* data, size_t len, uint64_t offset) {
+        while (len > 0) {
+            iovec iov;
+            iov.iov_base = (void*)data;
+            iov.iov_len = len;
+            ssize_t n = pwritev(m_fd, &iov, 1, offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cout << "IoUringFileLogAppender pwritev " << m_filename << " failed: " << strerror(errno) << std::endl;
+                return;
+            }
+            data += n;
+            len -= n;
+            offset += n;
+        }
+    }
+
+    // 信号处理函数里使用，出错时不打印
+    static void EmergencyPwrite(int fd, const char* data, size_t len, uint64_t offset) {
+        while (len > 0) {
+            ssize_t n = pwrite(fd, data, len, offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += n;
+            len -= n;
+            offset += n;
+        }
+    }
+
+    void IoUringFileLogAppender::emergencyFlush() {
+        if (m_fd < 0) {
+            return;
+        }
+        // 在途的请求进程退出时可能被取消，同样的内容写到同样的位置，重写一遍没有副作用
+        for (auto& buf : m_buffers) {
+            if (buf.busy) {
+                EmergencyPwrite(m_fd, buf.data, buf.len, buf.offset);
+            }
+        }
+        if (m_current >= 0) {
+            Buffer& buf = m_buffers[m_current];
+            if (!buf.busy && buf.len) {
+                EmergencyPwrite(m_fd, buf.data, buf.len, m_offset);
+                m_offset += buf.len;
+                buf.len = 0;
+            }
+        }
+    }
+
+    void IoUringFileLogAppender::emergencyWrite(const char* data, size_t len) {
+        emergencyFlush();
+        if (m_fd >= 0) {
+            EmergencyPwrite(m_fd, data, len, m_offset);
+            m_offset += len;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef __WEBSERVER_URING_APPENDER_H__
+#define __WEBSERVER_URING_APPENDER_H__
+
+#include <string>
+#include <vector>
+#include "log.h"
+
+namespace webserver {
+
+    struct IoUring;
+
+// 通过io_uring写文件的Appender
+    /*
+     * 日志先追加到几块预先注册给内核的固定缓冲区里，一块写满后才提交一次写请求，
+     * 多条日志合并成一次提交，并且不需要每条日志一次系统调用
+     * 提交后不等待完成，继续写下一块缓冲区，只有所有缓冲区都在写时才等待
+     * 文件描述符也注册给内核(IOSQE_FIXED_FILE)，省掉每次请求查找fd的开销
+     * 不满一块的日志在flush()时提交，配合AsyncLogAppender使用可以定时flush
+     * 内核不支持io_uring(或被禁用)时退化为同步的pwritev
+     * */
+    class IoUringFileLogAppender : public LogAppender {
+    public:
+        typedef std::shared_ptr<IoUringFileLogAppender> ptr;
+
+        /*
+         * filename 文件名，已存在时追加写
+         * buffer_size 每块缓冲区的大小，即一次写请求的最大长度
+         * buffer_count 缓冲区个数，即最多同时在途的写请求数
+         * sync 每次写请求后是否跟一个fdatasync
+         * */
+        IoUringFileLogAppender(const std::string& filename, size_t buffer_size = 1024 * 1024,
+                               size_t buffer_count = 4, bool sync = false);
+        ~IoUringFileLogAppender();
+
+        void log(const Logger& logger, LogLevel::Level level, const LogEvent& event) override;
+        void logFormatted(const Logger& logger, LogLevel::Level level, const LogEvent& event,
+                          const char* data, size_t len) override;
+        void write(const char* data, size_t len) override;
+        // 提交当前缓冲区并等待所有写请求完成
+        void flush() override;
+        // 崩溃时用pwrite同步写出还没完成的缓冲区
+        void emergencyFlush() override;
+        void emergencyWrite(const char* data, size_t len) override;
+
+        bool isOpen() const { return m_fd >= 0; }
+        // 是否在使用io_uring，false表示退化成了pwritev
+        bool isUring() const { return m_ring != nullptr; }
+
+    private:
+        struct Buffer {
+            char* data = nullptr;
+            size_t len = 0;        // 已写入的长度
+            uint64_t offset = 0;   // 写入文件的偏移
+            bool busy = false;     // 已提交，等待完成
+        };
+
+        bool setupRing();
+        void closeRing();
+        // 取一块空闲缓冲区，没有则等待写请求完成
+        int acquireBuffer();
+        void submitBuffer(int idx);
+        // 收割完成的写请求，wait为true时至少等待一个
+        void reap(bool wait);
+        // 同步写入，用于退化模式和短写的补写
+        void writeSync(const char* data, size_t len, uint64_t offset);
+
+    private:
+        std::string m_filename;
+        size_t m_bufferSize;
+        bool m_sync;
+        int m_fd = -1;
+        uint64_t m_offset = 0;          // 下一次写请求的文件偏移
+        std::vector<Buffer> m_buffers;
+        int m_current = -1;             // 正在追加的缓冲区
+        size_t m_inflight = 0;          // 在途的请求数(包括fdatasync)
+        IoUring* m_ring = nullptr;
+        bool m_fixedBuffers = false;    // 缓冲区是否注册成功
+        bool m_fixedFile = false;       // fd是否注册成功
+    };
+}
+
+#endif
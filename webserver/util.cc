@@ -0,0 +1,77 @@
+#include "util.h"
+#include "macro.h"
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+namespace webserver {
+
+    // 线程身份的缓存，每条日志都要用，不能每次都进内核
+    struct ThreadInfo {
+        uint32_t tid = 0;
+        bool hasName = false;
+        uint8_t nameLen = 0;
+        char name[THREAD_NAME_SIZE];
+    };
+
+    static thread_local ThreadInfo t_thread;
+
+    // fork出的子进程里只剩调用fork的线程，它的tid变了
+    static void ResetThreadIdAfterFork() {
+        t_thread.tid = 0;
+    }
+
+    static const int s_atfork = pthread_atfork(nullptr, nullptr, ResetThreadIdAfterFork);
+
+    uint32_t GetThreadId() {
+        if (WEBSERVER_UNLIKELY(t_thread.tid == 0)) {
+            (void)s_atfork;
+            t_thread.tid = syscall(SYS_gettid);
+        }
+        return t_thread.tid;
+    }
+
+    std::string_view GetThreadName() {
+        ThreadInfo& info = t_thread;
+        if (WEBSERVER_UNLIKELY(!info.hasName)) {
+            if (pthread_getname_np(pthread_self(), info.name, sizeof(info.name)) != 0) {
+                info.name[0] = '\0';
+            }
+            info.nameLen = strnlen(info.name, sizeof(info.name) - 1);
+            info.hasName = true;
+        }
+        return std::string_view(info.name, info.nameLen);
+    }
+
+    void SetThreadName(std::string_view name) {
+        ThreadInfo& info = t_thread;
+        size_t len = name.size() < THREAD_NAME_SIZE - 1 ? name.size() : THREAD_NAME_SIZE - 1;
+        memcpy(info.name, name.data(), len);
+        info.name[len] = '\0';
+        info.nameLen = len;
+        info.hasName = true;
+        pthread_setname_np(pthread_self(), info.name);
+    }
+
+    // 进程启动时记录一次，之后都用单调时钟计算差值
+    static uint64_t GetMonotonicMS() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+    }
+
+    static const uint64_t s_start_ms = GetMonotonicMS();
+
+    uint32_t GetElapsedMS() {
+        return GetMonotonicMS() - s_start_ms;
+    }
+
+    void GetCurrentTime(uint64_t& sec, uint32_t& nsec) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sec = ts.tv_sec;
+        nsec = ts.tv_nsec;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __WEBSERVER_UTIL_H__
+#define __WEBSERVER_UTIL_H__
+
+#include <stdint.h>
+#include <string_view>
+
+namespace webserver {
+
+    // 当前线程的内核线程id，每个线程只在第一次调用时gettid，fork后的子进程重新获取
+    uint32_t GetThreadId();
+
+    // 线程名称最长15个字节(和内核的限制一致)，超出的部分截断
+    static const size_t THREAD_NAME_SIZE = 16;
+
+    /*
+     * 当前线程的名称，第一次调用时从内核读取(默认是进程名)，之后直接返回缓存
+     * 返回的内存属于当前线程，线程退出后失效
+     * */
+    std::string_view GetThreadName();
+
+    // 设置当前线程的名称，同时通过pthread_setname_np设置到内核(top/gdb里可见)
+    void SetThreadName(std::string_view name);
+
+    // 进程启动到现在的毫秒数
+    uint32_t GetElapsedMS();
+
+    // 当前时间，sec 为秒，nsec 为不足一秒的纳秒数
+    void GetCurrentTime(uint64_t& sec, uint32_t& nsec);
+}
+
+#endif